@@ -0,0 +1,110 @@
+// Microbenchmark of the vector clock kernels: for N = 8 ... 1024 processes, nanoseconds per operation
+// of each version supported by the CPU, generic and specialized for N ("/N", fixed widths up to 128),
+// and of the former scalar loop on 64-bit entries (<=) as reference.
+// usage: clock_bench [iterations]
+
+#include "clock_kernels.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace clock_kernels;
+
+
+namespace{
+
+// keeps the results alive, so that the compiler does not remove the loops
+volatile std::size_t sink = 0;
+
+template <typename F>
+double nanosecondsPerOp(std::size_t iterations, F f){
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; i++){
+        f(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(iterations);
+}
+
+// a <= b everywhere, so that comparisons scan the whole clock
+uint32_t entry(std::size_t i){
+    return static_cast<uint32_t>(i * 7 % 1000);
+}
+
+bool lessEqualLegacy(const std::vector<std::size_t> & a, const std::vector<std::size_t> & b){
+    for (std::size_t i = 0; i < a.size(); i++){
+        if (a[i] > b[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+void benchmarkLegacy(std::size_t n, std::size_t iterations){
+    std::vector<std::size_t> a(n), b(n);
+    for (std::size_t i = 0; i < n; i++){
+        a[i] = entry(i);
+        b[i] = a[i] + i % 2;
+    }
+    double less_equal = nanosecondsPerOp(iterations, [&](std::size_t i){
+        b[0] = i;
+        sink = sink + lessEqualLegacy(a, b);
+    });
+    std::printf("%6zu %10s %10.1f %10s %10s %10s\n", n, "legacy", less_equal, "-", "-", "-");
+}
+
+// kernels selected with configure and select
+void benchmarkKernels(const std::string & name, std::size_t n, std::size_t iterations){
+    std::vector<uint32_t> a(n), b(n), c(n, 0), increments(n, 1);
+    for (std::size_t i = 0; i < n; i++){
+        a[i] = entry(i);
+        b[i] = a[i] + static_cast<uint32_t>(i % 2);
+    }
+    // the first entry changes at every iteration, so that the calls are not hoisted out of the loops
+    double less_equal = nanosecondsPerOp(iterations, [&](std::size_t i){
+        b[0] = static_cast<uint32_t>(i);
+        sink = sink + firstGreater(a.data(), b.data(), 0, n);
+    });
+    double less_than = nanosecondsPerOp(iterations, [&](std::size_t i){
+        b[0] = static_cast<uint32_t>(i);
+        sink = sink + lessThan(a.data(), b.data(), n);
+    });
+    double merged = nanosecondsPerOp(iterations, [&](std::size_t i){
+        b[0] = static_cast<uint32_t>(i);
+        merge(c.data(), b.data(), n);
+    });
+    double added = nanosecondsPerOp(iterations, [&](std::size_t i){
+        increments[0] = static_cast<uint32_t>(i % 2);
+        add(c.data(), increments.data(), n);
+    });
+    sink = sink + c[n - 1];
+    std::printf("%6zu %10s %10.1f %10.1f %10.1f %10.1f\n", n, name.c_str(), less_equal, less_than, merged, added);
+}
+
+}
+
+
+int main(int argc, char ** argv){
+    std::size_t iterations = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+
+    std::printf("%6s %10s %10s %10s %10s %10s\n", "N", "kernels", "<=", "<", "merge", "add");
+    for (std::size_t n = 8; n <= 1024; n *= 2){
+        benchmarkLegacy(n, iterations);
+        for (Isa isa : {SCALAR, SSE4, AVX2}){
+            // a width larger than all the fixed ones disables the specialized kernels
+            configure(std::numeric_limits<std::size_t>::max());
+            if (!select(isa)){
+                continue;
+            }
+            benchmarkKernels(getIsaName(isa), n, iterations);
+            configure(n);
+            if (select(isa) && getWidth() == n){
+                benchmarkKernels(getIsaName(isa) + "/" + std::to_string(n), n, iterations);
+            }
+        }
+    }
+    return 0;
+}
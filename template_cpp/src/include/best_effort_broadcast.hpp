@@ -6,29 +6,58 @@
 #include "perfect_link.hpp"
 #include "uniform_reliable_broadcast.hpp"
 #include "parser.hpp"
+#include "priority_scheduler.hpp"
+#include "settings.hpp"
 
 using namespace packet;
 
 class PerfectLink;
 class UniformReliableBroadcast;
 
+// packet waiting in the queues of the broadcast thread
+struct OutgoingPacket{
+    Packet packet;
+    std::vector<std::size_t> dest_ids;  // empty to send to every process
+
+    OutgoingPacket(Packet p, std::vector<std::size_t> i_dest_ids): packet(p), dest_ids(i_dest_ids){}
+};
+
+
 class BestEffortBroadcast{
     private:
         PerfectLink* perfect_link;
-        // packets that have source_id = this process id
-        ThreadSafeQueue<Packet> packets_to_broadcast;
-        // packets that have source_id != this process id, and have to be retransmitted
-        ThreadSafeQueue<Packet> packets_to_re_broadcast;
 
-        ThreadSafeQueue<Packet> packets_to_deliver;
+        // queues of the broadcast thread
+        static const std::size_t RE_BROADCAST = 0;  // packets that have source_id != this process id, and have to be
+                                                    // retransmitted (and URB control packets)
+        static const std::size_t BROADCAST = 1;     // packets that have source_id = this process id
+
+        /* re-broadcasts are served before new broadcasts (DA_BEB_RELAY_WEIGHT re-broadcasts for every
+           DA_BEB_BROADCAST_WEIGHT broadcasts, 0 for strict priority), so that packets of the other processes
+           are not delayed by our own. The re-broadcast queue is unbounded: it is filled by the
+           deliver thread, that must never block on the broadcast thread
+        */
+        PriorityScheduler<OutgoingPacket> scheduler = PriorityScheduler<OutgoingPacket>({
+            {settings::getSize("BEB_RELAY_WEIGHT", 4), 0},
+            {settings::getSize("BEB_BROADCAST_WEIGHT", 1), 512}});
+
+        // max number of packets taken from the queues at once
+        const std::size_t batch_size = settings::getSize("BEB_BATCH", 16);
+
+        // received packets are handed to URB by several workers, packets of the same source always go to
+        // the same worker (packets_to_deliver[source_id % num_deliver_workers]) so that their order is kept,
+        // control packets are spread by sender
+        const std::size_t num_deliver_workers = std::max(settings::getSize("BEB_DELIVER_WORKERS",
+                                                            std::min(std::thread::hardware_concurrency(), 4u)), std::size_t(1));
+        std::vector<ThreadSafeQueue<Packet>> packets_to_deliver = std::vector<ThreadSafeQueue<Packet>>(num_deliver_workers);
 
         UniformReliableBroadcast* urb;
 
-        // consumes packets_to_deliver queue and executes BEBDeliver defined 
-        // by UniformReliableBroadcast (1 permanent Thread)
-        void deliver();
+        // consumes packets_to_deliver[worker_id] queue and executes BEBDeliver defined 
+        // by UniformReliableBroadcast (num_deliver_workers permanent Threads)
+        void deliver(std::size_t worker_id);
 
-        // consumes first packets_to_re_broadcast, then packets_to_broadcast
+        // consumes the queues of scheduler, blocking when they are empty
         // 1 permanent Thread
         void broadcast();
 
@@ -36,30 +65,59 @@ class BestEffortBroadcast{
 
 
     public:
-        BestEffortBroadcast( PerfectLink* pl, std::vector<Parser::Host> i_hosts): 
-           perfect_link(pl), hosts(i_hosts){}; 
+        // registers the depths of the queues as metrics
+        BestEffortBroadcast( PerfectLink* pl, std::vector<Parser::Host> i_hosts);
 
 
         void setURB(UniformReliableBroadcast* i_urb){
             urb = i_urb;
         }
 
-        // contains pointers to running threads (deliver, broadcast)
+        // contains pointers to running threads (deliver workers, broadcast)
         std::vector<std::thread *> threads; 
 
         void deliver(Packet p){
-            packets_to_deliver.push(p);
+            std::size_t key = p.source_id != 0 ? p.source_id : p.process_id;
+            packets_to_deliver[key % num_deliver_workers].push(p);
+        }
+
+        // dest_ids restricts the destinations (used by the URB tree overlay), empty for every process
+        void broadcast(Packet p, std::vector<std::size_t> dest_ids = std::vector<std::size_t>()){
+            scheduler.push(BROADCAST, OutgoingPacket(p, dest_ids));
         }
 
-        void broadcast(Packet p){
-            packets_to_broadcast.push(p);
+        void re_broadcast(Packet p, std::vector<std::size_t> dest_ids = std::vector<std::size_t>()){
+            scheduler.push(RE_BROADCAST, OutgoingPacket(p, dest_ids));
         }
 
-        void re_broadcast(Packet p){
-            packets_to_re_broadcast.push(p);
+        // sends p to dest_id only, with the priority of re-broadcasts (never blocks)
+        void send(Packet p, std::size_t dest_id){
+            scheduler.push(RE_BROADCAST, OutgoingPacket(p, std::vector<std::size_t>(1, dest_id)));
+        }
+
+        // true if there are received packets not yet handed to URB
+        bool hasPacketsToDeliver(){
+            for (ThreadSafeQueue<Packet> & queue : packets_to_deliver){
+                if (queue.getSize() > 0){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // true if process_id is suspected to have crashed by the perfect link
+        bool isSuspected(std::size_t process_id);
+
+        // the packets of source i + 1 with sequence number lower than watermark[i] were delivered
+        // by every process, the perfect link forgets them
+        void trimDelivered(std::vector<std::size_t> watermark);
+
+        // depth and starvation metrics of the re-broadcast (0) and broadcast (1) queues
+        std::vector<SchedulerClassStats> getSchedulerStats(){
+            return scheduler.getStats();
         }
 
-        // starts threads (deliver, broadcast) and adds them to threads
+        // starts threads (deliver workers, broadcast) and adds them to threads
         void start();
 
 
@@ -11,40 +11,76 @@
 #include <mutex> 
 #include <condition_variable>
 #include "vector_clock.hpp"
+#include "settings.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <deque>
 
 using namespace packet;
 
 class UniformReliableBroadcast;
 class ProcessController;
 
+// packet URB delivered but not yet causally delivered
+struct BlockedPacket{
+    Packet packet;
+    std::size_t entry;  // process id of the first entry of the vector clock that may not be met
+    std::chrono::steady_clock::time_point urb_delivered;
+};
+
+
 class CausalBroadcast{
 
     private:
 
-        bool end_broadcast = false;
-
+        /* protects the delivery state and the vector clocks. URB deliveries are accepted at any time
+           and never wait for the broadcaster: the messages of a packet are added without the mutex, then the
+           packet is stamped with the dependencies delivered so far and logged as broadcast with the mutex held,
+           so that no delivery can be logged in between, and it is handed to URB after releasing it */
         std::mutex mutex;
-        // condition variable to wait on broadcast until packet is delivered to not flood the network
+        // condition variable to wait on broadcast until an own packet is delivered to not flood the network
         std::condition_variable broadcast_cv;
 
-        bool can_broadcast = true;   
+        // max number of own packets broadcast and not yet delivered (DA_CAUSAL_WINDOW)
+        const std::size_t window = std::max(settings::getSize("CAUSAL_WINDOW", 1), std::size_t(1));
 
-        // current packet sequence number for this process
+        // current packet sequence number for this process (written only by the broadcaster, with the mutex held)
         std::size_t cur_seq_num = 0;
-        
-        // pending[source_id][seg_num] returns the corresponding packet (process_id does not matter in packets)
-        std::map<std::size_t, std::map< std::size_t, Packet>> pending;
 
-        // next[source_id] returns the next expected packet sequence number from process with id source_id
-        std::map<long unsigned int, long unsigned int> next;
+        // number of own packets delivered
+        std::size_t num_own_delivered = 0;
+        
+        /* blocked[id][counter] returns the packets waiting for vc_recv[id] to reach counter, the first entry of
+           their vector clock greater than vc_recv (process_id does not matter in packets). When a packet of id
+           is delivered only the packets waiting for the new value of vc_recv[id] are examined again, from the
+           entry they were waiting for (the previous ones are met forever since vc_recv only grows).
+           The entry of the source of a packet is its sequence number, so packets of a source are delivered in order */
+        std::map<std::size_t, std::map<std::size_t, std::vector<BlockedPacket>>> blocked;
+        // number of packets in blocked, read by the metrics without the mutex
+        std::atomic<std::size_t> num_blocked{0};
+
+        // broadcast time of the own packets not yet delivered, in order (mutex held)
+        std::deque<std::chrono::steady_clock::time_point> own_broadcast_times;
+
+        // time from the URB delivery to the causal delivery, and from the broadcast to the delivery of own packets
+        metrics::Histogram & wait_latency = metrics::histogram("causal_wait_us");
+        metrics::Histogram & own_delivery_latency = metrics::histogram("causal_own_delivery_us");
 
         // total number of processes in the distributed system
         std::size_t num_processes;
 
         std::set<std::size_t> locality;
 
+        // entries carried by the clocks of own packets: locality and this process
+        std::set<std::size_t> dependencies;
+
         VectorClock vc_send;
 
+        // clock of own packets with every dependency at num_messages: at least as long as any stamp,
+        // the messages are added to a packet before knowing its clock
+        VectorClock vc_send_bound;
+
         VectorClock vc_recv;
 
         // lower level abstraction
@@ -55,6 +91,13 @@ class CausalBroadcast{
         // permanent Thread that consumes packets_to_deliver
         void causalDeliver(Packet p);
 
+        // adds b to blocked if an entry of its vector clock is not met yet (mutex held)
+        bool block(BlockedPacket & b);
+
+        // updates the vector clocks after the delivery of a packet of source_id, and moves to ready
+        // the packets that were waiting for it (mutex held)
+        void unblock(std::size_t source_id, std::vector<BlockedPacket> & ready);
+
         //  Thread creating packets containing messages with
         // seq num from 1 to num_messages included, and broadcast them to other processes
         void broadcast();
@@ -66,6 +109,13 @@ class CausalBroadcast{
 
         VectorClock getSendVectorClock();
 
+        // builds the packet with the messages from next_message on (advanced past them), leaving room for
+        // the longest clock (without the mutex)
+        Packet nextPacket(std::size_t & next_message);
+
+        // stamps packet with the current dependencies and logs it as broadcast (mutex held)
+        void stampPacket(Packet & packet);
+
 
     public:
         // initializes next, and sets num_messags
@@ -0,0 +1,53 @@
+#ifndef CLOCK_KERNELS_H
+#define CLOCK_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+Kernels on vector clocks stored as arrays of 32-bit counters. AVX2 (8 entries per instruction) or
+SSE4.1 (4 entries) versions are chosen at startup from the features of the CPU, with a scalar fallback
+(other architectures, or DA_CLOCK_KERNELS=scalar|sse4|avx2 to force a version the CPU supports).
+Every version is also instantiated for the fixed widths 8, 16, 32, 64 and 128 (loops with constant
+bounds, unrolled by the compiler): the one configured for the size of the system is used for arrays of
+exactly that width, the generic one for any other length
+*/
+namespace clock_kernels{
+
+enum Isa{SCALAR, SSE4, AVX2};
+
+// smallest fixed width holding num_processes entries, num_processes if it is larger than all of them
+std::size_t paddedWidth(std::size_t num_processes);
+
+// selects the kernels specialized for paddedWidth(num_processes), called at startup from the hosts file
+void configure(std::size_t num_processes);
+
+// fixed width configured, 0 if none
+std::size_t getWidth();
+
+// index of the first i in [from, n) with a[i] > b[i], n if there is none (a <= b if firstGreater(a, b, 0, n) == n)
+std::size_t firstGreater(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t n);
+
+// a <= b and a != b
+bool lessThan(const uint32_t * a, const uint32_t * b, std::size_t n);
+
+// a[i] = max(a[i], b[i])
+void merge(uint32_t * a, const uint32_t * b, std::size_t n);
+
+// a[i] += b[i], applies a batch of increments
+void add(uint32_t * a, const uint32_t * b, std::size_t n);
+
+// version in use
+Isa getIsa();
+std::string getIsaName(Isa isa);
+
+// true if the CPU supports isa
+bool isSupported(Isa isa);
+
+// uses isa from now on if supported (used by the benchmark), returns false otherwise
+bool select(Isa isa);
+
+}
+
+#endif
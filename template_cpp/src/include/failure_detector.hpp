@@ -0,0 +1,56 @@
+#ifndef FAILURE_DETECTOR_H
+#define FAILURE_DETECTOR_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include "settings.hpp"
+
+/*
+Eventually perfect failure detector based on ack silence: a process is suspected when
+it has not sent anything for timeout while packets for it are waiting for an ack.
+If a suspected process is heard from again, it is restored and its timeout is increased,
+so that eventually correct processes are never suspected.
+Suspected processes are probed with exponentially increasing intervals.
+Thread safe
+*/
+class FailureDetector{
+    private:
+        struct PeerState{
+            std::chrono::steady_clock::time_point last_heard = std::chrono::steady_clock::now();
+            std::chrono::milliseconds timeout;
+            bool suspected = false;
+            std::chrono::steady_clock::time_point next_probe;
+            std::chrono::milliseconds probe_interval;
+            std::size_t num_suspicions = 0;
+        };
+
+        std::mutex mutex;
+
+        std::map<std::size_t, PeerState> peers;
+
+        const std::chrono::milliseconds initial_timeout = std::chrono::milliseconds(settings::getSize("FD_TIMEOUT_MS", 5000));
+        const std::chrono::milliseconds initial_probe_interval = std::chrono::milliseconds(settings::getSize("FD_PROBE_MS", 1000));
+        const std::chrono::milliseconds max_probe_interval = std::chrono::milliseconds(settings::getSize("FD_MAX_PROBE_MS", 64000));
+
+        // returns the state of process_id, creating it if needed
+        PeerState & getPeer(std::size_t process_id);
+
+    public:
+        FailureDetector(){}
+
+        // to be called for every packet received from process_id,
+        // returns true if process_id was suspected (and is now restored)
+        bool heardFrom(std::size_t process_id);
+
+        // to be called when packets for process_id are waiting for an ack: suspects process_id
+        // if it has been silent for longer than its timeout, returns true if it is newly suspected
+        bool checkSilence(std::size_t process_id, std::chrono::steady_clock::time_point now);
+
+        bool isSuspected(std::size_t process_id);
+
+        // returns true if a suspected process has to be probed now, and schedules the next probe
+        bool probeDue(std::size_t process_id, std::chrono::steady_clock::time_point now);
+};
+
+#endif
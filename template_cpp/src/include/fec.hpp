@@ -0,0 +1,143 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include "packet.hpp"
+
+/*
+Forward error correction for the perfect link. After every k data packets sent for the first time
+to a destination, m parity datagrams are sent, computed with a systematic Reed-Solomon code over
+GF(2^8) (Cauchy matrix), so that the receiver can rebuild up to m lost packets of the group
+without waiting for the retransmission timeout.
+
+The outbox packs the packets sent to a destination in frames (one datagram), so consecutive first
+transmissions are lost together. Each destination therefore fills `interleave` groups at once: the i-th
+protected packet of a frame goes to group i, and the outbox starts a new frame after `interleave` protected
+packets, so that losing a frame costs each group at most one packet (recovered with m >= 1).
+
+Parity datagrams start with PARITY_TAG (data packets start with a digit), followed by the
+'\0' terminated fields: sender_id, group_id, k, m, index of the parity, shard_length,
+then source_id, packet_seq_num, length of each data packet of the group, and shard_length bytes of parity
+*/
+namespace fec{
+
+const char PARITY_TAG = 'F';
+
+// max number of data packets in a group, so that parity datagrams fit in MAX_DATAGRAM_LENGTH
+const std::size_t MAX_GROUP_SIZE = 64;
+
+inline bool isParity(const char * datagram, std::size_t length){
+    return length > 0 && datagram[0] == PARITY_TAG;
+}
+
+// (source_id, packet_seq_num) of a data packet
+typedef std::pair<std::size_t, std::size_t> PacketId;
+
+
+// used by the single thread sending datagrams
+class Encoder{
+    private:
+        struct Group{
+            std::vector<std::string> shards;    // encoded data packets
+            std::vector<PacketId> ids;
+        };
+
+        std::size_t sender_id;
+        std::size_t k;
+        std::size_t m;
+        std::size_t interleave;
+
+        // groups being filled for each destination (interleave of them)
+        std::map<std::size_t, std::vector<Group>> groups;
+        // id of the next group encoded for each destination, increasing so that the decoder drops the oldest groups
+        std::map<std::size_t, std::size_t> next_group_ids;
+
+        std::size_t parity_sent = 0;
+
+        // returns the m parity datagrams of group, and starts a new one
+        std::vector<std::string> encode(std::size_t dest_id, Group & group);
+
+    public:
+        Encoder(std::size_t i_sender_id, std::size_t i_k, std::size_t i_m, std::size_t i_interleave = 1);
+
+        bool isEnabled() const{
+            return k > 0 && m > 0;
+        }
+
+        // number of protected packets a frame can carry, each in a different group
+        std::size_t getInterleave() const{
+            return interleave;
+        }
+
+        /* adds the encoded data packet sent to dest_id, as the lane-th protected packet of its frame
+           (lane < interleave), returns the parity datagrams to be sent to dest_id (empty if the group is not complete)
+        */
+        std::vector<std::string> add(std::size_t dest_id, std::size_t lane, PacketId id, const char * bytes, std::size_t length);
+
+        // closes the groups that are not complete, returns the parity datagrams to send and their destination
+        std::vector<std::pair<std::size_t, std::string>> flush();
+
+        bool hasPartialGroups() const;
+
+        std::size_t getParitySent() const{
+            return parity_sent;
+        }
+};
+
+
+// used by the single thread receiving datagrams
+class Decoder{
+    private:
+        struct ParityGroup{
+            std::size_t k = 0;
+            std::size_t m = 0;
+            std::size_t shard_length = 0;
+            std::vector<PacketId> ids;
+            std::vector<std::size_t> lengths;
+            std::map<std::size_t, std::string> parities; // index of the parity -> parity shard
+        };
+
+        struct SenderState{
+            // encoded data packets recently received
+            std::map<PacketId, std::string> cache;
+            std::deque<PacketId> cache_order;
+            // groups with parities received but not enough of them to recover the missing packets
+            std::map<std::size_t, ParityGroup> groups;
+        };
+
+        // a group spans up to k * interleave packets sent to this process
+        const std::size_t max_cached_packets = 4096;
+        const std::size_t max_groups = 64;
+
+        std::map<std::size_t, SenderState> senders;
+
+        // written by the receiving thread, read by others through getRecovered
+        std::atomic<std::size_t> recovered{0};
+
+        void cache(SenderState & sender, PacketId id, const char * bytes, std::size_t length);
+
+        // rebuilds the missing packets of group if enough parities were received, returns them
+        std::vector<packet::Packet> recover(SenderState & sender, ParityGroup & group, bool & done);
+
+    public:
+        Decoder(){}
+
+        // to be called for every data packet received
+        void onData(std::size_t sender_id, PacketId id, const char * bytes, std::size_t length);
+
+        // returns the data packets that could be rebuilt thanks to the parity datagram
+        std::vector<packet::Packet> onParity(const char * datagram, std::size_t length);
+
+        std::size_t getRecovered() const{
+            return recovered.load(std::memory_order_relaxed);
+        }
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <utility>
+#include "packet.hpp"
+
+/*
+Frames carry several link-layer packets for the same destination (data packets of any source,
+acks, nacks) in a single datagram, up to MAX_DATAGRAM_LENGTH bytes.
+Frames start with FRAME_TAG (data packets start with a digit, parity datagrams with fec::PARITY_TAG),
+followed, for each packet, by its length as a '\0' terminated field and by its bytes
+*/
+namespace frame{
+
+const char FRAME_TAG = 'M';
+
+inline bool isFrame(const char * datagram, std::size_t length){
+    return length > 0 && datagram[0] == FRAME_TAG;
+}
+
+
+// builds frames in a buffer of MAX_DATAGRAM_LENGTH bytes, used by a single thread
+class Writer{
+    private:
+        char * buffer;
+        std::size_t length = 1;         // FRAME_TAG
+        std::size_t num_packets = 0;
+        // position of the bytes of the first packet, sent alone if it is the only one
+        std::size_t first_offset = 0;
+        std::size_t first_length = 0;
+
+        static std::size_t entryLength(std::size_t packet_length){
+            return std::to_string(packet_length).size() + 1 + packet_length;
+        }
+
+    public:
+        explicit Writer(char * i_buffer): buffer(i_buffer){
+            buffer[0] = FRAME_TAG;
+        }
+
+        bool empty() const{
+            return num_packets == 0;
+        }
+
+        // true if a packet of packet_length bytes can be added to the frame
+        bool fits(std::size_t packet_length) const{
+            return length + entryLength(packet_length) <= static_cast<std::size_t>(packet::MAX_DATAGRAM_LENGTH);
+        }
+
+        // adds a packet of packet_length bytes, returns where its bytes have to be written
+        char * append(std::size_t packet_length){
+            std::string field = std::to_string(packet_length);
+            std::memcpy(buffer + length, field.c_str(), field.size() + 1);
+            length += field.size() + 1;
+            if (num_packets == 0){
+                first_offset = length;
+                first_length = packet_length;
+            }
+            char * bytes = buffer + length;
+            length += packet_length;
+            num_packets++;
+            return bytes;
+        }
+
+        // datagram to send: the frame, or the packet itself if it is alone
+        const char * data() const{
+            return num_packets == 1 ? buffer + first_offset : buffer;
+        }
+
+        std::size_t size() const{
+            return num_packets == 1 ? first_length : length;
+        }
+
+        std::size_t getNumPackets() const{
+            return num_packets;
+        }
+
+        void clear(){
+            length = 1;
+            num_packets = 0;
+        }
+};
+
+
+// returns the position and length of the packets of a frame, ignores a truncated last entry
+inline std::vector<std::pair<char *, std::size_t>> split(char * datagram, std::size_t length){
+    std::vector<std::pair<char *, std::size_t>> packets;
+    std::size_t offset = 1;
+    while (offset < length){
+        const char * field_end = static_cast<const char *>(std::memchr(datagram + offset, '\0', length - offset));
+        if (field_end == NULL){
+            break;
+        }
+        std::size_t packet_length = std::stoul(std::string(datagram + offset));
+        offset = static_cast<std::size_t>(field_end - datagram) + 1;
+        if (packet_length == 0 || offset + packet_length > length){
+            break;
+        }
+        packets.push_back(std::make_pair(datagram + offset, packet_length));
+        offset += packet_length;
+    }
+    return packets;
+}
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "settings.hpp"
+
+// packet broadcast or delivered: messages first_msg_seq_num ... first_msg_seq_num + num_messages - 1 of source_id
+struct LogRecord{
+    char type;  // 'b' or 'd'
+    uint32_t source_id;
+    uint32_t num_messages;
+    std::size_t first_msg_seq_num;
+};
+
+
+/*
+Writes the output file off the delivery path. Producers append a record per packet to a ring of
+DA_LOG_RING records (single producer: calls must be serialized, they are all made with the mutex of
+CausalBroadcast held, so that the order of the lines is the order of the events). The writer thread
+formats the records in a buffer of DA_LOG_BUFFER bytes and writes it when full or when the ring is empty.
+A producer waits only if the ring is full.
+With DA_LOG_RANGES=1 a line is written for each run of consecutive messages instead of each message,
+"b first last" and "d source_id first last" (tools/expand_log.py converts the file to one line per message).
+
+The buffer is appended to the file with pwrite at the commit offset, that is published once the bytes are
+in the file: the file holds only complete lines, even if the process is killed (SIGKILL loses the records
+not written yet, not the ones before). The writer thread blocks SIGTERM and SIGINT, so that the signal
+handler can wait for it to finish its current pass (at most drain_batch records), and then format and write
+the rest of the ring itself: stop() only uses atomics, the preallocated buffer, pwrite and nanosleep,
+so it is async-signal-safe
+*/
+class LogWriter{
+    private:
+        int fd = -1;
+
+        // bytes of the file written, all complete lines
+        std::atomic<std::size_t> committed{0};
+
+        const std::size_t capacity = ringCapacity(settings::getSize("LOG_RING", 1 << 16));
+        std::vector<LogRecord> ring = std::vector<LogRecord>(capacity);
+        // records head ... tail - 1 are in the ring (positions modulo capacity)
+        std::atomic<std::size_t> head{0};
+        std::atomic<std::size_t> tail{0};
+
+        // ranges mode: run of messages not written yet, extended by the next records while they are contiguous
+        const bool ranges = settings::getFlag("LOG_RANGES", false);
+        bool has_range = false;
+        LogRecord range;
+
+        std::vector<char> buffer = std::vector<char>(std::max(settings::getSize("LOG_BUFFER", 1 << 20), std::size_t(4096)));
+        std::size_t buffer_length = 0;
+
+        // sleep of the writer thread when the ring is empty
+        const std::chrono::microseconds idle_sleep = std::chrono::microseconds(settings::getSize("LOG_IDLE_US", 1000));
+
+        // max number of records formatted by a pass of the writer thread
+        const std::size_t drain_batch = 1024;
+
+        // the writer thread sets busy during a pass, and stops once it sees stopping
+        std::atomic<bool> busy{false};
+        std::atomic<bool> stopping{false};
+
+        // smallest power of 2 >= requested (at least 64)
+        static std::size_t ringCapacity(std::size_t requested);
+
+        // formats up to max_records records of the ring, returns false if it was empty
+        bool drain(std::size_t max_records);
+
+        void format(const LogRecord & record);
+
+        void formatRange(const LogRecord & record);
+
+        // ranges mode: formats the pending run
+        void closeRange();
+
+        void writeBuffer();
+
+        // permanent thread draining the ring
+        void write();
+
+    public:
+        // creates (or truncates) the output file, returns false if it cannot be opened
+        bool open(const std::string & path);
+
+        void append(char type, std::size_t source_id, std::size_t first_msg_seq_num, std::size_t num_messages);
+
+        // records appended and not yet formatted
+        std::size_t getBacklog(){
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+        // bytes written to the output file
+        std::size_t getCommitted(){
+            return committed.load(std::memory_order_acquire);
+        }
+
+        // stops the writer thread and writes every record appended so far, records appended later are
+        // not written. Async-signal-safe, called by the signal handler
+        void stop();
+
+        // contains the writer thread
+        std::vector<std::thread *> threads;
+
+        void start();
+};
+
+#endif
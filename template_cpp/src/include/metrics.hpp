@@ -0,0 +1,159 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "settings.hpp"
+
+/*
+Counters and latency histograms of the layers, and gauges sampled on demand (queue depths, occupancy).
+Metrics are registered by name on first use and live until the process exits, so layers keep references
+to them. Updates are sharded per thread: a thread only updates its own shard with relaxed atomic operations
+(a cache line per shard for counters), shards are summed when a snapshot is taken.
+
+Snapshots are text, one metric per line ("name value", per peer metrics are named name{peer="id"}),
+histograms are reported as name_count, name_sum, name_max and name{quantile="q"}. They are written by the
+Exporter every DA_METRICS_PERIOD_MS milliseconds to DA_METRICS_FILE (appended, each snapshot starts with
+"# time_ms" and ends with an empty line), and/or to each client connecting to the Unix socket DA_METRICS_SOCKET.
+In both paths {id} is replaced by the id of the process. Nothing is exported if neither is set
+*/
+namespace metrics{
+
+    // threads are assigned to shards round robin
+    constexpr std::size_t NUM_SHARDS = 16;
+
+    // shard of the calling thread
+    inline std::size_t shardIndex(){
+        static std::atomic<std::size_t> next_shard{0};
+        thread_local std::size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % NUM_SHARDS;
+        return shard;
+    }
+
+
+    class Counter{
+        private:
+            struct alignas(64) Shard{
+                std::atomic<uint64_t> value{0};
+            };
+            std::array<Shard, NUM_SHARDS> shards;
+
+        public:
+            void add(uint64_t n = 1){
+                shards[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+            }
+
+            uint64_t getValue() const;
+    };
+
+
+    struct HistogramSnapshot{
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> counts;   // per bucket
+
+        // smallest bucket bound such that a fraction q of the values is not above it (at most max)
+        uint64_t quantile(double q) const;
+    };
+
+
+    /*
+    HDR-style histogram of values from 0 to 2^64 - 1 with a relative error of at most 1 / SUB_BUCKETS:
+    values below SUB_BUCKETS have their own bucket, then every power of 2 is split in SUB_BUCKETS buckets.
+    Latencies are recorded in microseconds
+    */
+    class Histogram{
+        public:
+            static constexpr std::size_t SUB_BUCKET_BITS = 4;
+            static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BUCKET_BITS;
+            static constexpr std::size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+            static std::size_t bucketIndex(uint64_t value){
+                if (value < SUB_BUCKETS){
+                    return static_cast<std::size_t>(value);
+                }
+                std::size_t exponent = static_cast<std::size_t>(63 - __builtin_clzll(value));
+                std::size_t sub_bucket = static_cast<std::size_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+                return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+            }
+
+            // largest value of the bucket
+            static uint64_t bucketUpperBound(std::size_t index);
+
+            Histogram();
+
+            void record(uint64_t value){
+                Shard & shard = shards[shardIndex()];
+                shard.counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+                shard.sum.fetch_add(value, std::memory_order_relaxed);
+                // several threads may share the shard
+                uint64_t cur_max = shard.max.load(std::memory_order_relaxed);
+                while (value > cur_max && !shard.max.compare_exchange_weak(cur_max, value, std::memory_order_relaxed)){}
+            }
+
+            void recordSince(std::chrono::steady_clock::time_point start){
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+            }
+
+            HistogramSnapshot getSnapshot() const;
+
+        private:
+            struct alignas(64) Shard{
+                std::array<std::atomic<uint64_t>, NUM_BUCKETS> counts;
+                std::atomic<uint64_t> sum;
+                std::atomic<uint64_t> max;
+            };
+            std::array<Shard, NUM_SHARDS> shards;
+    };
+
+
+    // counter or histogram registered with that name, created on first use
+    Counter & counter(const std::string & name);
+    Histogram & histogram(const std::string & name);
+
+    // sample is called at every snapshot, what it reads must live until the process exits
+    void gauge(const std::string & name, std::function<double()> sample);
+
+    // name{label="value"}, or name{labels,label="value"} if name has labels already
+    std::string labeled(const std::string & name, const std::string & label, const std::string & value);
+
+    inline std::string perPeer(const std::string & name, std::size_t peer_id){
+        return labeled(name, "peer", std::to_string(peer_id));
+    }
+
+    // every metric registered, sorted by name
+    std::string snapshot();
+
+
+    // writes the snapshots to the file and/or the socket configured by the environment
+    class Exporter{
+        private:
+            const std::chrono::milliseconds period = std::chrono::milliseconds(
+                std::max(settings::getSize("METRICS_PERIOD_MS", 1000), std::size_t(1)));
+            std::string file_path = settings::getString("METRICS_FILE", "");
+            std::string socket_path = settings::getString("METRICS_SOCKET", "");
+
+            // permanent thread appending a snapshot to file_path every period
+            void writeFile();
+
+            // permanent thread sending a snapshot to each client of socket_path
+            void serveSocket();
+
+        public:
+            // contains the threads of the file and of the socket, if enabled
+            std::vector<std::thread *> threads;
+
+            void start(std::size_t process_id);
+    };
+}
+
+#endif
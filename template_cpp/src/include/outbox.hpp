@@ -2,42 +2,239 @@
 #define OUTBOX_H
 
 #include <map>
+#include <deque>
+#include <vector>
+#include <chrono>
 #include "packet.hpp"
 #include <mutex>
 #include <condition_variable>
 #include "packet_proc_id.hpp"
 #include "udp_scocket.hpp"
+#include "token_bucket.hpp"
+#include "settings.hpp"
+#include "failure_detector.hpp"
+#include "fec.hpp"
+#include "frame.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <assert.h>
 
 using namespace packet;
 
 
-typedef std::map<std::size_t, std::map<std::size_t, Packet>> SourceId_2_SeqNum_2_Packet;
+// packet kept in the outbox until the corresponding ack is received,
+// the packet itself is shared with the entries of the other destinations
+struct OutBoxEntry{
+    Packet_ProcId packet;
+    bool sent = false;  // true after the first transmission
+    bool timed_out = false;  // counted as timed out by a sweep, until it is sent again
+    std::chrono::steady_clock::time_point last_sent;
+
+    explicit OutBoxEntry(Packet_ProcId p): packet(p){}
+    OutBoxEntry(){}
+};
+
+typedef std::map<std::size_t, std::map<std::size_t, OutBoxEntry>> SourceId_2_SeqNum_2_Entry;
+
+// (source_id, packet_seq_num) of a packet kept in the outbox
+typedef std::pair<std::size_t, std::size_t> PacketKey;
+
+
+// how many datagrams and bytes the transmit scheduler handed to the socket for one destination
+struct PeerServiceStats{
+    std::size_t acks_sent = 0;
+    std::size_t first_sent = 0;     // first transmissions of packets
+    std::size_t retransmitted = 0;
+    std::size_t bytes_sent = 0;
+    std::size_t turns = 0;          // number of times the destination was visited by the scheduler
+    std::size_t paced = 0;          // number of times the destination was skipped for lack of tokens
+    double pacing_rate = 0;         // current rate of the token bucket of the destination (bytes/s, 0 = unlimited)
+    std::size_t probes = 0;         // packets sent while the destination was suspected
+};
+
+
+/*
+Pacing of outgoing datagrams (acks excluded): a global token bucket and one per destination.
+The rate of each destination is adapted to the loss observed at every retransmission sweep
+(multiplicative decrease when too many packets time out, additive increase otherwise).
+Every value can be set by the environment variable DA_PACING_<NAME>, rates are in bytes/s
+*/
+struct PacingSettings{
+    double global_rate = settings::getDouble("PACING_RATE", 0);
+    double global_burst = settings::getDouble("PACING_BURST", 256 * 1024);
+    double peer_rate = settings::getDouble("PACING_PEER_RATE", 64 * 1024 * 1024);
+    double peer_burst = settings::getDouble("PACING_PEER_BURST", 128 * 1024);
+    bool autotune = settings::getFlag("PACING_AUTOTUNE", true);
+    double min_rate = settings::getDouble("PACING_MIN_RATE", 256 * 1024);
+    double max_rate = settings::getDouble("PACING_MAX_RATE", 256 * 1024 * 1024);
+    // fraction of transmissions timing out above which the rate of a destination is decreased
+    double loss_threshold = settings::getDouble("PACING_LOSS_THRESHOLD", 0.01);
+    double decrease_factor = 0.7;
+};
+
+
+// counters of the data packets exchanged with a peer (sent, retransmitted and bytes_sent are updated by the outbox)
+struct PeerLinkMetrics{
+    metrics::Counter * sent = NULL;            // first transmissions
+    metrics::Counter * retransmitted = NULL;
+    metrics::Counter * bytes_sent = NULL;      // packets and acks handed to the socket (as PeerServiceStats::bytes_sent)
+    metrics::Counter * acked = NULL;           // removed from the outbox by an ack (or a cumulative ack)
+    metrics::Counter * received = NULL;
+    metrics::Counter * duplicated = NULL;      // received again after their delivery
+
+    explicit PeerLinkMetrics(std::size_t peer_id):
+        sent(&metrics::counter(metrics::perPeer("pl_sent", peer_id))),
+        retransmitted(&metrics::counter(metrics::perPeer("pl_retransmitted", peer_id))),
+        bytes_sent(&metrics::counter(metrics::perPeer("pl_bytes_sent", peer_id))),
+        acked(&metrics::counter(metrics::perPeer("pl_acked", peer_id))),
+        received(&metrics::counter(metrics::perPeer("pl_received", peer_id))),
+        duplicated(&metrics::counter(metrics::perPeer("pl_duplicated", peer_id))){}
+    PeerLinkMetrics(){}
+};
+
+
+// datagram selected by the scheduler
+struct ScheduledDatagram{
+    Packet_ProcId packet;
+    bool first_transmission;    // true for data packets sent for the first time (protected by FEC)
+
+    ScheduledDatagram(Packet_ProcId p, bool first): packet(p), first_transmission(first){}
+};
+
+
+// state of a destination for one of the two classes served by the scheduler
+struct SchedulingClass{
+    std::size_t deficit = 0;    // in bytes
+    bool active = false;        // true if the destination is in the list of active destinations of the class
+    bool in_turn = false;       // true if the destination is being served (at the head of the list)
+};
+
+
+/*
+Transmit state of a single destination. Packets waiting for an ack stay in packets,
+fresh and retransmit only hold keys, that may refer to packets already acked (skipped when served)
+*/
+struct DestinationQueue{
+    SourceId_2_SeqNum_2_Entry packets;
+    std::deque<Packet_ProcId> acks;     // acks are sent once and never kept
+    std::deque<PacketKey> fresh;        // packets that were never sent
+    std::deque<PacketKey> retransmit;   // packets scheduled by the last retransmission sweep
+
+    SchedulingClass urgent;         // acks and fresh packets
+    SchedulingClass retransmission;
+
+    TokenBucket bucket;
+    // transmissions and timed out packets since the last adaptation of the rate (a packet times out once
+    // until it is sent again, however many sweeps find it still waiting)
+    std::size_t sent_since_tune = 0;
+    std::size_t timed_out_since_tune = 0;
+
+    // link_index[source_id][link_seq_num] returns the packet_seq_num of the packet (nack mode only)
+    std::map<std::size_t, std::map<std::size_t, std::size_t>> link_index;
+
+    // number of packets in packets
+    std::size_t num_packets = 0;
+    // true if the destination is suspected to have crashed: its packets are only sent as sparse
+    // probes and do not count for the capacity of the outbox
+    bool suspected = false;
+
+    PeerServiceStats stats;
+    PeerLinkMetrics metrics;
+};
 
 
 class OutBox{
     friend class PerfectLink;
 
     private:
-        size_t curr_size;
+        // number of packets of destinations that are not suspected
+        size_t curr_size = 0;
         size_t max_size = 1000;
+
+        // bytes a destination may send every time it is visited by the scheduler
+        static constexpr std::size_t quantum = MAX_LENGTH;
+        // max number of datagrams sent for each call of sendPackets (lock is released in between)
+        static constexpr std::size_t batch_size = 64;
+        // interval between two retransmission sweeps
+        const std::chrono::milliseconds sweep_period = std::chrono::milliseconds(500);
+        // a packet is retransmitted if not acked this long after its last transmission
+        const std::chrono::milliseconds retransmit_timeout = std::chrono::milliseconds(2 * 1000);
+
+        PacingSettings pacing;
+        TokenBucket global_bucket;
+        // earliest time at which a destination skipped for lack of tokens can send again
+        std::chrono::steady_clock::time_point pacing_resume;
+
         //condition variables for add operation
-        std::condition_variable cv_add;  
+        std::condition_variable cv_add;
+        // signaled when acks or packets never sent are available
+        std::condition_variable cv_send;
         std::mutex mutex;  // lock for the outbox
 
-        // packets kept in the outbox
-        // packet.process_id is the process owning the outbox, 
+        // packets kept in the outbox, per destination process id
+        // packet.process_id is the process owning the outbox,
         // so it is the same for all packets
-        std::map<std::size_t, // destination process id
-                    std::map<std::size_t, // source process id
-                        std::map<std::size_t, // packet sequence number
-                            Packet>>> packets;
+        std::map<std::size_t, DestinationQueue> destinations;
+
+        // destinations with acks or fresh packets (served first), and destinations with
+        // retransmissions, visited in round robin order
+        std::deque<std::size_t> urgent_active;
+        std::deque<std::size_t> retransmit_active;
+
+        std::chrono::steady_clock::time_point next_sweep = std::chrono::steady_clock::now();
 
         std::map<std::size_t, sockaddr_in> * host_addresses;
 
+        FailureDetector * failure_detector = NULL;
+
+        // computes the parity of first transmissions, used only by the thread calling sendPackets
+        fec::Encoder fec_encoder = fec::Encoder(0, 0, 0);
+
+        // datagrams for the same destination in a batch are coalesced in frames (DA_LINK_FRAMES=0 disables it)
+        const bool frames = settings::getFlag("LINK_FRAMES", true);
+        char buffer_send[MAX_DATAGRAM_LENGTH];
+        frame::Writer frame_writer = frame::Writer(buffer_send);
+        // datagrams handed to the socket (parity included), and packets sent in them, used only by the thread calling sendPackets
+        std::size_t datagrams_sent = 0;
+        std::size_t packets_sent = 0;
+
+        // sends the frame being built to dest_id, then the parity datagrams computed meanwhile
+        void flushFrame(UDPSocket * udp_socket, std::size_t dest_id, std::vector<std::string> & parities);
+
+        // schedules for retransmission the packets whose ack timed out, and adapts pacing rates
+        void sweep(std::chrono::steady_clock::time_point now);
+
+        // stops sending to dest (except for probes), its packets are no longer counted in curr_size
+        void suspect(DestinationQueue & dest);
+
+        // adapts the rate of dest to the loss observed since the last call
+        void tunePacing(DestinationQueue & dest, std::chrono::steady_clock::time_point now);
+
+        // returns the queue of dest_id, creating it (with its token bucket) if needed
+        DestinationQueue & getDestination(std::size_t dest_id);
+
+        // true if the datagram can be sent now according to the token buckets, consumes tokens
+        bool admit(DestinationQueue & dest, const Packet_ProcId & datagram, std::chrono::steady_clock::time_point now);
+
+        // deficit round robin over the destinations in active, appends to batch the
+        // datagrams to be sent, returns when batch is full, active is empty or every
+        // destination in active is waiting for tokens
+        void serve(std::deque<std::size_t> & active, bool urgent, std::vector<ScheduledDatagram> & batch);
+
+        // next datagram of the given class for dest without removing it, NULL if there is none.
+        // Drops keys of packets that have already been acked
+        const Packet_ProcId * headDatagram(DestinationQueue & dest, bool urgent);
+
+        // removes the datagram returned by headDatagram and accounts it in the statistics of dest
+        void popDatagram(DestinationQueue & dest, bool urgent);
+
+        // adds dest_id to the list of active destinations of the class if not already there
+        void activate(std::size_t dest_id, SchedulingClass & sched, std::deque<std::size_t> & active);
+
     public:
 
         explicit OutBox(std::map<std::size_t, sockaddr_in> * host_addresses) :
+            global_bucket(pacing.global_rate, std::max(pacing.global_burst, static_cast<double>(MAX_LENGTH))),
             host_addresses(host_addresses){}
 
         /* adds packet to outbox, if it is full
@@ -45,16 +242,53 @@ class OutBox{
         */
         void addPacket(Packet_ProcId const pack_and_dest);
 
+        // adds ack to be sent, acks are never retransmitted and have priority over retransmissions
+        void addAck(Packet_ProcId const ack_and_dest);
+
         // returns true if successfully removed packet, false if there was not
         // the specified packet, waits only to own the lock of the outbox
         bool removePacket(unsigned long int dest_proc_id, unsigned long int source_id, unsigned long int seq_num);
 
+        // called when a suspected destination is heard from again: all its packets are sent again
+        // right away and are counted again in the capacity
+        void restore(std::size_t dest_id);
+
+        // nack mode: removes all the packets for dest_proc_id with source_id and link
+        // sequence number up to link_seq_num, returns the number of packets removed
+        std::size_t removeUpTo(std::size_t dest_proc_id, std::size_t source_id, std::size_t link_seq_num);
 
+        // nack mode: schedules for retransmission the packet for dest_proc_id with the given source and
+        // link sequence number, returns false if the packet is not in the outbox
+        bool retransmitLink(std::size_t dest_proc_id, std::size_t source_id, std::size_t link_seq_num);
+
+        // returns true if a retransmission sweep was due and has been done
+        bool sweepIfDue();
+
+        /* waits until there is something to send (or the next sweep is due), then sends a batch of
+           datagrams: acks and first transmissions are served before retransmissions,
+           destinations are served in deficit round robin, and datagrams are paced by token buckets.
+           Datagrams for the same destination are sent together in frames, with at most one packet of each FEC group per frame.
+           When there is nothing to send, closes the FEC groups that are not complete
+        */
         void sendPackets(UDPSocket * udp_socket);
 
+        // number of link-layer packets sent for each datagram (> 1 thanks to frames)
+        double getPacketsPerDatagram() const{
+            return datagrams_sent == 0 ? 0 : static_cast<double>(packets_sent) / static_cast<double>(datagrams_sent);
+        }
+
+        // number of packets kept for destinations that are not suspected (at most max_size)
+        std::size_t getOccupancy(){
+            std::unique_lock<std::mutex> lock(mutex);
+            return curr_size;
+        }
+
+        // returns statistics about the service received by each destination
+        std::map<std::size_t, PeerServiceStats> getServiceStats();
+
         void debug();
 
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -13,6 +13,16 @@
 namespace packet{
 
 const int MAX_LENGTH = 4096; // max length of Packet in bytes
+const int MAX_DATAGRAM_LENGTH = 8192; // max length of a datagram (a packet or a parity datagram)
+
+// DATA packets carry messages and are kept by the sender until acknowledged,
+// the other types are link level control packets that are sent only once
+enum PacketType{
+    DATA = 0,
+    ACK = 1,            // acknowledges the data packet with the same source_id, packet_seq_num
+    NACK = 2,           // messages are the link_seq_num of missing packets from source_id (nack mode)
+    CUMULATIVE_ACK = 3  // acknowledges all packets from source_id up to link_seq_num (nack mode)
+};
 
 class Message{
     private:
@@ -25,16 +35,16 @@ class Message{
         //default copy constructor
 
         /* return length of string + 1 considering NULL char at the end*/
-        int get_length(){
+        int get_length() const{
             return static_cast<int>(payload.length()) + 1;
         }
 
-        std::string getContent(){
+        std::string getContent() const{
             return payload;
         }
         
         /* writes message payload into buffer */
-        void toBytes(char * buffer){
+        void toBytes(char * buffer) const{
             std::strcpy(buffer, payload.c_str());
         }
 
@@ -66,11 +76,14 @@ class Packet{
         std::size_t process_id;   // process id of the sender
         std::size_t source_id;    // process id of the original process that sent this packet
         std::size_t packet_seq_num;   // sequence number of the packet
+        // position of the packet in the stream of packets with source_id sent by process_id
+        // to the destination, assigned by the perfect link in nack mode (0 otherwise)
+        std::size_t link_seq_num = 0;
         std::size_t first_msg_seq_num = 0; // sequence number of the first message
         std::size_t payload_length = 0; // number of bytes of payload
         std::size_t num_processes; // number of processes in the system
         VectorClock vector_clock;  // has length equal to num_processes
-        bool is_ack = false;
+        PacketType type = DATA;
 
         Packet(std::size_t i_process_id, std::size_t i_source_id, std::size_t i_packet_seq_num, 
                         std::size_t i_num_processes, VectorClock i_vector_clock) : 
@@ -87,8 +100,12 @@ class Packet{
             }
         }
 
+        bool isData() const{
+            return type == DATA;
+        }
+
         bool canAddMessage(Message m){
-            if (is_ack){
+            if (type == ACK || type == CUMULATIVE_ACK){
                 return false;
             }else{
                 /*
@@ -102,7 +119,7 @@ class Packet{
 
         // see if can add message keeping margin_bytes unset at the end of the buffer
         bool canAddMessage(Message m, unsigned long int margin_bytes){
-            if (is_ack){
+            if (type == ACK || type == CUMULATIVE_ACK){
                 return false;
             }else{
                 /*
@@ -129,15 +146,26 @@ class Packet{
         }
 
         /*transform packet into bytes and writes them into buffer */
-        void toBytes(char* buffer);
+        void toBytes(char* buffer) const{
+            toBytes(buffer, link_seq_num);
+        }
 
-        unsigned long int getNumMessages(){
+        // same as toBytes, with the link sequence number of the destination instead of link_seq_num,
+        // so that the same packet can be shared by all the destinations of a broadcast
+        void toBytes(char* buffer, std::size_t i_link_seq_num) const;
+
+        unsigned long int getNumMessages() const{
             return messages.size();
         }
 
         // return length of Packet in bytes
-        std::size_t getLength(){
-            std::size_t header_length = getHeaderLength(); //NULL characters
+        std::size_t getLength() const{
+            return getLength(link_seq_num);
+        }
+
+        // length of Packet in bytes when sent with link sequence number i_link_seq_num
+        std::size_t getLength(std::size_t i_link_seq_num) const{
+            std::size_t header_length = getHeaderLength(i_link_seq_num); //NULL characters
 
             std::size_t vc_length = vector_clock.getBytesLength();
 
@@ -145,20 +173,25 @@ class Packet{
         }
 
 
-        std::size_t getHeaderLength(){
+        std::size_t getHeaderLength() const{
+            return getHeaderLength(link_seq_num);
+        }
+
+        std::size_t getHeaderLength(std::size_t i_link_seq_num) const{
              std::size_t header_length = std::to_string(process_id).size() + 
                                 std::to_string(packet_seq_num).size() + 
+                                std::to_string(i_link_seq_num).size() +
                                 std::to_string(source_id).size() + 
                                 std::to_string(first_msg_seq_num).size() +
-                                std::to_string(static_cast<unsigned int>(is_ack)).size() +
+                                std::to_string(static_cast<unsigned int>(type)).size() +
                                 std::to_string(payload_length).size() +
-                                std::to_string(num_processes).size() + 7;
+                                std::to_string(num_processes).size() + 8;
             return header_length;
         }
 
 
         //return message at position i
-        Message getMessage(std::size_t i){
+        Message getMessage(std::size_t i) const{
             return messages[i];
         }
 
@@ -170,11 +203,30 @@ class Packet{
         static Packet createAck(std::size_t i_process_id, std::size_t i_source_id, std::size_t i_packet_seq_num,
                                 std::size_t num_processes, VectorClock vector_clock){
             Packet ackPacket = Packet(i_process_id, i_source_id, i_packet_seq_num, num_processes, vector_clock);
-            ackPacket.is_ack = true;
+            ackPacket.type = ACK;
             ackPacket.payload_length = 0;
             return ackPacket;
         }
 
+        // nack for the packets of the stream (i_process_id, i_source_id) with link sequence numbers in missing,
+        // the caller checks that they fit in the packet
+        static Packet createNack(std::size_t i_process_id, std::size_t i_source_id, std::vector<std::size_t> missing){
+            Packet nack = Packet(i_process_id, i_source_id, 0, 0, VectorClock(0));
+            nack.type = NACK;
+            for (std::size_t link_seq_num : missing){
+                nack.addMessage(Message(std::to_string(link_seq_num)));
+            }
+            return nack;
+        }
+
+        // acknowledges all the packets with source i_source_id up to link sequence number i_link_seq_num
+        static Packet createCumulativeAck(std::size_t i_process_id, std::size_t i_source_id, std::size_t i_link_seq_num){
+            Packet ack = Packet(i_process_id, i_source_id, 0, 0, VectorClock(0));
+            ack.type = CUMULATIVE_ACK;
+            ack.link_seq_num = i_link_seq_num;
+            return ack;
+        }
+
 };
 }
 
@@ -1,12 +1,35 @@
 #ifndef PACKET_PROC_ID_H
 #define PACKET_PROC_ID_H
 
+#include <memory>
 #include "packet.hpp"
-// packet to be sent, needs also process id of the destination host
+
+// immutable packet, shared by all the destinations it is sent to (one allocation per broadcast)
+typedef std::shared_ptr<const packet::Packet> SharedPacket;
+
+// packet to be sent, needs also process id of the destination host.
+// The packet is shared, the fields that depend on the destination are kept here
 struct Packet_ProcId{
-    packet::Packet packet;
+    SharedPacket packet;
     std::size_t dest_proc_id;
-    Packet_ProcId(packet::Packet p, std::size_t dest_id): packet(p), dest_proc_id(dest_id){}
+    std::size_t link_seq_num = 0;   // assigned by the perfect link in nack mode
+
+    Packet_ProcId(SharedPacket p, std::size_t dest_id): packet(p), dest_proc_id(dest_id){}
+    // keeps the link sequence number of p, that carries the acked prefix of cumulative acks
+    Packet_ProcId(packet::Packet p, std::size_t dest_id):
+        dest_proc_id(dest_id), link_seq_num(p.link_seq_num){
+        packet = std::make_shared<const packet::Packet>(std::move(p));
+    }
+    Packet_ProcId(): dest_proc_id(0){}
+
+    // length of the packet sent to dest_proc_id
+    std::size_t getLength() const{
+        return packet -> getLength(link_seq_num);
+    }
+
+    void toBytes(char * buffer) const{
+        packet -> toBytes(buffer, link_seq_num);
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
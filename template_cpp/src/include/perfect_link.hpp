@@ -10,14 +10,36 @@
 #include "best_effort_broadcast.hpp"
 #include <mutex>
 #include "outbox.hpp"
+#include "failure_detector.hpp"
+#include "fec.hpp"
+#include "sequence_set.hpp"
+#include "trace.hpp"
 #include "parser.hpp"
 #include <thread>
 #include <chrono>
+#include <atomic>
 
 using namespace packet;
 
 class BestEffortBroadcast;
 
+
+// state of the receiver for the stream of packets with a given (sender, source), nack mode only
+struct LinkStream{
+    std::size_t next_expected = 1;  // all the packets with lower link sequence number were received
+    std::set<std::size_t> above;    // packets received with link sequence number > next_expected
+    std::size_t acked_up_to = 0;    // last link sequence number sent in a cumulative ack
+    std::size_t received_since_ack = 0;
+    std::size_t highest_nacked = 0;
+};
+
+
+/*
+In the default (ack) mode every data packet is acknowledged and retransmitted until its ack arrives.
+In nack mode (DA_LINK_MODE=nack) packets to a destination are numbered per source (link_seq_num),
+the receiver sends a nack as soon as it detects a gap, and a cumulative ack every
+cumulative_ack_every packets (and at every retransmission sweep) that releases the outbox of the sender
+*/
 class PerfectLink{
     private:
         friend class OutBox;
@@ -32,34 +54,70 @@ class PerfectLink{
 
         // delivered[process_id][source_id] returns the set of sequence numbers of packets delivered
         // that were received from process_id, with original sender source_id
-        std::map<std::size_t, std::map<std::size_t, std::set<std::size_t>>> delivered;
+        std::map<std::size_t, std::map<std::size_t, SequenceSet>> delivered;
+
+        // stability watermark set by trimDelivered, applied to delivered by the thread processing
+        // arrived packets (the only one accessing delivered)
+        std::mutex watermark_mutex;
+        std::vector<std::size_t> watermark;
+        std::atomic<bool> watermark_changed{false};
+
+        // marks as delivered the packets of every sender below the watermark of their source
+        void applyWatermark();
 
         // queue of packets that have to be added to OutBox
         ThreadSafeQueue<Packet_ProcId> packets_to_send;
 
-        // queue of acks to be sent, not added to outbox, but sent as soon as sender_lock is available 
+        // queue of acks to be sent, handed to the outbox that sends them once, before any retransmission
         ThreadSafeQueue<Packet_ProcId> acks_to_send;
 
+        bool nack_mode = false;
+
+        // nack mode: number of packets of a stream received before sending a cumulative ack
+        const std::size_t cumulative_ack_every = settings::getSize("CUMULATIVE_ACK_EVERY", 32);
+
+        // nack mode: next_link_seq_num[dest_id][source_id] is the last link sequence number assigned to
+        // packets from source_id sent to dest_id (accessed only by addPacketsToOutBox)
+        std::map<std::size_t, std::map<std::size_t, std::size_t>> next_link_seq_num;
+
+        // nack mode: streams[sender_id][source_id] is the state of the corresponding stream of received packets
+        std::map<std::size_t, std::map<std::size_t, LinkStream>> streams;
+        std::mutex streams_mutex;
+
+        // rebuilds data packets lost in FEC groups, used only by the listener thread
+        fec::Decoder fec_decoder;
+
+        // buffer of the listener thread
+        char buffer_received[MAX_DATAGRAM_LENGTH];
+
         // Higher abstraction, perfect link delivers to beb
         BestEffortBroadcast* beb = NULL;
 
-        // used to synchronize Thread that sends acks and Thread that sends normal packets
-        std::mutex sender_lock;
-
         // keeps non-ack messages that are sent periodically, messages are removed when an
         // ack is received
         OutBox outbox; 
 
+        // counters of the packets received from each peer, the map is not modified after construction
+        std::map<std::size_t, PeerLinkMetrics> peer_metrics;
+
+        // suspects processes that stopped acking, used by the outbox to stop retransmitting to them
+        FailureDetector failure_detector;
+
         // sends received messages to higher abstraction (BestEffortBroadcast) when appropriate
         void deliver(Packet p);
 
-        // waits to receive messages and populates queue received_packets (1 Thread always listening)
+        // waits to receive messages and populates queue received_packets, with the packets
+        // of frames and the ones rebuilt from FEC parity (1 Thread always listening)
         void listen();
 
-        // consumes queue of acks to send, 1 Thread always sending when sender_lock is available
+        // decodes a packet received alone or in a frame and adds it to received_packets
+        void receivePacket(char * bytes, std::size_t length);
+
+        // consumes queue of acks to send and adds them to the OutBox, 1 Thread
         void sendAcks();
 
-        // send Packets periodically from the OutBox, 1 Thread periodically executing this function
+        // sends acks, new packets and periodic retransmissions from the OutBox, 1 Thread
+        // (the only one writing on the socket)
         void sendPackets();
 
         /* 1) If queue of arrived packets is non empty, take out first packet
@@ -71,6 +129,18 @@ class PerfectLink{
         */
         void processArrivedMessages();
         
+        // nack mode: updates the stream of received, queuing nacks for missing packets and cumulative acks
+        void trackLinkStream(Packet & received);
+
+        // adds to the acks to send the nacks for the link sequence numbers in missing
+        void queueNacks(std::size_t sender_id, std::size_t source_id, std::vector<std::size_t> & missing);
+
+        // adds to the acks to send the cumulative ack of the contiguous prefix of stream (streams_mutex held)
+        void queueCumulativeAck(std::size_t sender_id, std::size_t source_id, LinkStream & stream);
+
+        // sends a cumulative ack for every stream that received packets since its last one
+        void flushCumulativeAcks();
+
         // 1 Thread that consumes packets_to_send and populates outbox
         void addPacketsToOutBox();
 
@@ -93,9 +163,36 @@ class PerfectLink{
         void start();
 
         // called by higher abstraction to send reliably 
-        // a packet (eventually the packet is delivered by the PerfectLink of the receiver)
-        void send(Packet_ProcId packet_dest){
-            packets_to_send.push(packet_dest);
+        // a packet (eventually the packet is delivered by the PerfectLink of the receiver).
+        // Packets for this process are delivered directly, without socket, outbox or ack
+        void send(Packet_ProcId packet_dest);
+
+        // the packets of source i + 1 with sequence number lower than i_watermark[i] were delivered
+        // by every process, their sequence numbers are dropped from delivered (as if they were all received)
+        void trimDelivered(std::vector<std::size_t> i_watermark){
+            std::unique_lock<std::mutex> lock(watermark_mutex);
+            watermark = i_watermark;
+            watermark_changed.store(true);
+        }
+
+        // true if process_id is currently suspected to have crashed
+        bool isSuspected(std::size_t process_id){
+            return failure_detector.isSuspected(process_id);
+        }
+
+        // number of data packets sent for the first time protected by FEC parity datagrams, and of the
+        // ones rebuilt thanks to them (not retransmitted)
+        std::size_t getFecParitySent(){
+            return outbox.fec_encoder.getParitySent();
+        }
+
+        std::size_t getFecRecovered(){
+            return fec_decoder.getRecovered();
+        }
+
+        // statistics of the transmit scheduler for each destination process
+        std::map<std::size_t, PeerServiceStats> getServiceStats(){
+            return outbox.getServiceStats();
         }
 
         void closeSocket(){
@@ -0,0 +1,140 @@
+#ifndef PRIORITY_SCHEDULER_H
+#define PRIORITY_SCHEDULER_H
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <condition_variable>
+#include <assert.h>
+
+// metrics of one class of a PriorityScheduler
+struct SchedulerClassStats{
+    std::size_t depth = 0;          // items currently waiting
+    std::size_t max_depth = 0;
+    std::size_t pushed = 0;
+    std::size_t popped = 0;
+    std::size_t producer_waits = 0; // times a producer blocked because the class was full
+    std::size_t starved = 0;        // batches that served nothing of the class while it had items waiting
+    std::chrono::steady_clock::duration max_wait = std::chrono::steady_clock::duration::zero(); // longest time an item waited
+};
+
+
+/*
+Several FIFO queues consumed by a single thread, with one wait point: the consumer blocks
+until any of the queues has an item, and never polls.
+Queue 0 has the highest priority. Queues are served in weighted round robin: in every round
+queue i gives up to weight[i] items. A queue with weight 0 is served only when all the queues
+with higher priority are empty (strict priority).
+A queue with capacity 0 is unbounded, otherwise push() waits while it is full.
+Thread safe
+*/
+template <typename T>
+class PriorityScheduler{
+    private:
+        struct Item{
+            T elem;
+            std::chrono::steady_clock::time_point enqueued;
+        };
+
+        struct Class{
+            std::deque<Item> queue;
+            std::size_t weight;
+            std::size_t capacity;
+            SchedulerClassStats stats;
+        };
+
+        std::mutex mutex;
+        std::condition_variable cv_pop, cv_push;
+        std::vector<Class> classes;
+        std::size_t num_items = 0;
+
+        void take(Class & cur_class, std::vector<std::pair<std::size_t, T>> & batch, std::size_t class_id,
+                  std::chrono::steady_clock::time_point now){
+            Item & item = cur_class.queue.front();
+            cur_class.stats.max_wait = std::max(cur_class.stats.max_wait, now - item.enqueued);
+            batch.push_back(std::make_pair(class_id, item.elem));
+            cur_class.queue.pop_front();
+            cur_class.stats.popped++;
+            num_items--;
+        }
+
+    public:
+        // one queue for each (weight, capacity)
+        explicit PriorityScheduler(std::vector<std::pair<std::size_t, std::size_t>> weights_capacities){
+            for (auto & weight_capacity : weights_capacities){
+                Class cur_class;
+                cur_class.weight = weight_capacity.first;
+                cur_class.capacity = weight_capacity.second;
+                classes.push_back(cur_class);
+            }
+        }
+
+        void push(std::size_t class_id, T const elem){
+            std::unique_lock<std::mutex> lock(mutex);
+            assert((class_id < classes.size()) == true);
+            Class & cur_class = classes[class_id];
+            if (cur_class.capacity != 0 && cur_class.queue.size() >= cur_class.capacity){
+                cur_class.stats.producer_waits++;
+                while (cur_class.queue.size() >= cur_class.capacity){
+                    cv_push.wait(lock);
+                }
+            }
+            cur_class.queue.push_back(Item{elem, std::chrono::steady_clock::now()});
+            cur_class.stats.pushed++;
+            cur_class.stats.max_depth = std::max(cur_class.stats.max_depth, cur_class.queue.size());
+            num_items++;
+            cv_pop.notify_one();
+        }
+
+        /* waits until there is at least one item, then removes up to max_batch items
+           and appends them to batch as (class_id, item), in the order they have to be processed
+        */
+        void popBatch(std::vector<std::pair<std::size_t, T>> & batch, std::size_t max_batch){
+            std::unique_lock<std::mutex> lock(mutex);
+            while (num_items == 0){
+                cv_pop.wait(lock);
+            }
+            auto now = std::chrono::steady_clock::now();
+            std::size_t num_taken = 0;
+            std::vector<std::size_t> taken(classes.size(), 0);
+            while (num_taken < max_batch && num_items > 0){
+                // one weighted round robin round
+                bool higher_waiting = false;
+                for (std::size_t i = 0; i < classes.size() && num_taken < max_batch; i++){
+                    Class & cur_class = classes[i];
+                    std::size_t quota = cur_class.weight;
+                    if (quota == 0){
+                        quota = higher_waiting ? 0 : max_batch;
+                    }
+                    for (std::size_t j = 0; j < quota && !cur_class.queue.empty() && num_taken < max_batch; j++){
+                        take(cur_class, batch, i, now);
+                        taken[i]++;
+                        num_taken++;
+                    }
+                    higher_waiting = higher_waiting || !cur_class.queue.empty();
+                }
+            }
+            for (std::size_t i = 0; i < classes.size(); i++){
+                if (taken[i] == 0 && !classes[i].queue.empty()){
+                    classes[i].stats.starved++;
+                }
+            }
+            cv_push.notify_all();
+        }
+
+        std::vector<SchedulerClassStats> getStats(){
+            std::unique_lock<std::mutex> lock(mutex);
+            std::vector<SchedulerClassStats> stats;
+            for (Class & cur_class : classes){
+                SchedulerClassStats cur_stats = cur_class.stats;
+                cur_stats.depth = cur_class.queue.size();
+                stats.push_back(cur_stats);
+            }
+            return stats;
+        }
+};
+
+#endif
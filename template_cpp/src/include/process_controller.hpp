@@ -12,6 +12,9 @@
 #include "best_effort_broadcast.hpp"
 #include "uniform_reliable_broadcast.hpp"
 #include "causal_broadcast.hpp"
+#include "log_writer.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 // the process either sends o receives messages,
 // so it will have only one between PLSender and PLReceiver
@@ -27,7 +30,11 @@ class ProcessController{
 
         std::vector<Parser::Host> hosts;
         
-        std::ofstream output_file;
+        // writes the broadcast and delivered lines to the output file
+        LogWriter log_writer;
+
+        // writes the metrics of the layers to DA_METRICS_FILE / DA_METRICS_SOCKET
+        metrics::Exporter metrics_exporter;
 
         std::ifstream config_file;
 
@@ -55,12 +62,13 @@ class ProcessController{
         // initializes member variables
         ProcessController(std::size_t id, Parser parser);
 
-        // write packet delivered to output file
-        void onPacketDelivered(packet::Packet p);
+        // write packet delivered to output file (through the log writer, calls must be serialized)
+        void onPacketDelivered(const packet::Packet & p);
 
-        // write packet sent to output file
-        void onPacketBroadcast(packet::Packet p);
+        // write packet sent to output file (through the log writer, calls must be serialized)
+        void onPacketBroadcast(const packet::Packet & p);
 
+        // async-signal-safe, called by the signal handler
         void stopProcess();
 
         // initialize lower level abstractions and start broadcasting/delivering packets
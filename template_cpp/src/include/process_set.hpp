@@ -0,0 +1,47 @@
+#ifndef PROCESS_SET_H
+#define PROCESS_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <assert.h>
+
+const std::size_t MAX_PROCESSES = 128;  // max number of processes allowed by the project
+
+/*
+Set of process ids (from 1 to MAX_PROCESSES) as a fixed width bitset: 16 bytes,
+no allocation, size() is a popcount. Ids are only checked by assert, the ProcessController
+rejects host files with more than MAX_PROCESSES processes
+*/
+class ProcessSet{
+    private:
+        static const std::size_t num_words = MAX_PROCESSES / 64;
+        uint64_t words[num_words] = {};
+
+    public:
+        ProcessSet(){}
+
+        // returns true if process_id was not in the set
+        bool insert(std::size_t process_id){
+            assert(((process_id >= 1) && (process_id <= MAX_PROCESSES)) == true);
+            std::size_t idx = process_id - 1;
+            uint64_t mask = uint64_t(1) << (idx % 64);
+            bool inserted = (words[idx / 64] & mask) == 0;
+            words[idx / 64] |= mask;
+            return inserted;
+        }
+
+        bool contains(std::size_t process_id) const{
+            std::size_t idx = process_id - 1;
+            return (words[idx / 64] >> (idx % 64)) & 1;
+        }
+
+        std::size_t size() const{
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < num_words; i++){
+                count += static_cast<std::size_t>(__builtin_popcountll(words[i]));
+            }
+            return count;
+        }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SEQUENCE_SET_H
+#define SEQUENCE_SET_H
+
+#include <set>
+#include <cstddef>
+
+/*
+Set of sequence numbers (starting from 0) stored as the contiguous prefix 0..next_missing-1 plus the
+sparse set of the ones above it. Sequence numbers are mostly inserted in order, so the memory used
+stays proportional to the gaps and not to the number of elements
+*/
+class SequenceSet{
+    private:
+        std::size_t next_missing = 0;
+        std::set<std::size_t> above;
+
+    public:
+        SequenceSet(){}
+
+        // returns true if seq_num was not in the set
+        bool insert(std::size_t seq_num){
+            if (contains(seq_num)){
+                return false;
+            }
+            if (seq_num != next_missing){
+                above.insert(seq_num);
+                return true;
+            }
+            next_missing++;
+            auto it_seq = above.begin();
+            while (it_seq != above.end() && *it_seq == next_missing){
+                next_missing++;
+                it_seq = above.erase(it_seq);
+            }
+            return true;
+        }
+
+        // adds every sequence number lower than seq_num (known to be useless: stable)
+        void advanceTo(std::size_t seq_num){
+            if (seq_num <= next_missing){
+                return;
+            }
+            next_missing = seq_num;
+            auto it_seq = above.begin();
+            while (it_seq != above.end() && *it_seq <= next_missing){
+                if (*it_seq == next_missing){
+                    next_missing++;
+                }
+                it_seq = above.erase(it_seq);
+            }
+        }
+
+        bool contains(std::size_t seq_num) const{
+            return seq_num < next_missing || above.count(seq_num) == 1;
+        }
+
+        std::size_t count(std::size_t seq_num) const{
+            return contains(seq_num) ? 1 : 0;
+        }
+
+        // all the sequence numbers lower than getNextMissing() are in the set
+        std::size_t getNextMissing() const{
+            return next_missing;
+        }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <string>
+
+/*
+Optional tuning parameters. The command line is fixed by the template, so they are read
+from environment variables (DA_<NAME>), and fall back to default_value when not set or not valid
+*/
+namespace settings{
+
+    inline std::size_t getSize(const std::string & name, std::size_t default_value){
+        const char * value = std::getenv(("DA_" + name).c_str());
+        if (value == NULL){
+            return default_value;
+        }
+        try{
+            return std::stoul(value);
+        }
+        catch (std::exception const &){
+            return default_value;
+        }
+    }
+
+    inline double getDouble(const std::string & name, double default_value){
+        const char * value = std::getenv(("DA_" + name).c_str());
+        if (value == NULL){
+            return default_value;
+        }
+        try{
+            return std::stod(value);
+        }
+        catch (std::exception const &){
+            return default_value;
+        }
+    }
+
+    inline bool getFlag(const std::string & name, bool default_value){
+        return getSize(name, default_value ? 1 : 0) != 0;
+    }
+
+    inline std::string getString(const std::string & name, const std::string & default_value){
+        const char * value = std::getenv(("DA_" + name).c_str());
+        if (value == NULL){
+            return default_value;
+        }
+        return std::string(value);
+    }
+}
+
+#endif
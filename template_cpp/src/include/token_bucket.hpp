@@ -0,0 +1,81 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include <chrono>
+#include <algorithm>
+
+/*
+Token bucket used to pace outgoing datagrams: tokens (bytes) are added at rate per second
+up to burst, a datagram can be sent only if there are enough tokens for its length.
+A bucket with rate 0 is unlimited. Not thread safe, protected by the lock of the owner
+*/
+class TokenBucket{
+    private:
+        double rate = 0;    // bytes per second
+        double burst = 0;   // max number of tokens
+        double tokens = 0;
+        std::chrono::steady_clock::time_point last_refill = std::chrono::steady_clock::now();
+
+        void refill(std::chrono::steady_clock::time_point now){
+            std::chrono::duration<double> elapsed = now - last_refill;
+            if (elapsed.count() > 0){
+                tokens = std::min(burst, tokens + elapsed.count() * rate);
+                last_refill = now;
+            }
+        }
+
+    public:
+        TokenBucket(){}
+
+        TokenBucket(double i_rate, double i_burst) : rate(i_rate), burst(i_burst), tokens(i_burst){}
+
+        bool isUnlimited() const{
+            return rate <= 0;
+        }
+
+        double getRate() const{
+            return rate;
+        }
+
+        void setRate(double i_rate, std::chrono::steady_clock::time_point now){
+            refill(now);
+            rate = i_rate;
+        }
+
+        // removes length tokens and returns true if there are enough of them
+        bool tryConsume(std::size_t length, std::chrono::steady_clock::time_point now){
+            if (isUnlimited()){
+                return true;
+            }
+            refill(now);
+            if (tokens < static_cast<double>(length)){
+                return false;
+            }
+            tokens -= static_cast<double>(length);
+            return true;
+        }
+
+        // gives back tokens consumed by a datagram that was not sent
+        void refund(std::size_t length){
+            if (!isUnlimited()){
+                tokens = std::min(burst, tokens + static_cast<double>(length));
+            }
+        }
+
+        // time at which there will be enough tokens to send length bytes
+        std::chrono::steady_clock::time_point availableAt(std::size_t length, std::chrono::steady_clock::time_point now){
+            if (isUnlimited()){
+                return now;
+            }
+            refill(now);
+            double missing = static_cast<double>(length) - tokens;
+            if (missing <= 0){
+                return now;
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(missing / rate));
+            return now + wait;
+        }
+};
+
+#endif
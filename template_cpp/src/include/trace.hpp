@@ -0,0 +1,98 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+Trace points at the stages of a packet, compiled only when TRACE is defined (cmake -DDA_TRACE=ON),
+otherwise the macros are empty. Every thread records in its own ring of DA_TRACE_RING events (the most
+recent ones are kept), with no lock nor allocation: the thread is the only writer of its ring, and
+publishes the number of events recorded with a release store.
+Events carry the source and sequence number of the packet (and the peer it was received from or sent to),
+so that a packet can be followed across threads: the time between two points is the time it waited.
+
+trace::dump writes the rings as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) to DA_TRACE_FILE
+({id} replaced by the process id, default: output file + ".trace.json"). It is async-signal-safe, called by the
+signal handler: the events of a ring overwritten while it was copying them are skipped.
+The traces of the processes of a host share the time axis, tools/merge_traces.py merges them in a single file
+*/
+namespace trace{
+
+    // the names are in trace.cpp, in the same order
+    enum Point : uint16_t{
+        BROADCAST,          // packet created by causal broadcast
+        OUTBOX_INSERT,      // packet added to the outbox for a destination
+        OUTBOX_SEND,        // datagram of the packet handed to the socket
+        RECEIVE,            // datagram received (seq is its length)
+        DECODE,             // packet decoded from a datagram or a frame
+        ACK,                // ack received
+        OUTBOX_REMOVE,      // packet removed from the outbox by an ack
+        BEB_DELIVER,        // packet handed to URB by a BEB worker
+        URB_DELIVER,        // packet delivered by URB
+        CAUSAL_DELIVER,     // packet delivered by causal broadcast
+        OUTPUT_WRITE,       // write of the output file (duration, seq is the number of bytes)
+        NUM_POINTS
+    };
+
+    struct Event{
+        uint64_t timestamp;     // nanoseconds of the steady clock, the same for the processes of a host
+        uint32_t duration;      // nanoseconds, 0 for instant events
+        uint16_t point;
+        uint16_t peer;
+        uint32_t source;
+        uint64_t seq;
+    };
+
+    // max number of threads with a ring, the others are not traced
+    constexpr std::size_t MAX_THREADS = 64;
+
+    // path of the JSON file and id of the process (pid in the trace), before the threads start
+    void configure(const std::string & output_path, std::size_t process_id);
+
+    // timestamp of events
+    uint64_t now();
+
+    void record(Point point, std::size_t source, std::size_t seq, std::size_t peer = 0, uint64_t start = 0);
+
+    // name of the calling thread in the trace
+    void nameThread(const char * name);
+
+    // writes every ring to the trace file, async-signal-safe
+    void dump();
+
+    // complete event from construction to destruction
+    class Scope{
+        private:
+            Point point;
+            std::size_t source;
+            std::size_t seq;
+            uint64_t start = now();
+
+        public:
+            Scope(Point i_point, std::size_t i_source, std::size_t i_seq): point(i_point), source(i_source), seq(i_seq){}
+
+            ~Scope(){
+                record(point, source, seq, 0, start);
+            }
+
+            Scope(const Scope &) = delete;
+            Scope & operator=(const Scope &) = delete;
+    };
+}
+
+
+#ifdef TRACE
+#define TRACE_THREAD(name) trace::nameThread(name)
+#define TRACE_EVENT(point, ...) trace::record(trace::point, __VA_ARGS__)
+#define TRACE_SCOPE(point, ...) trace::Scope trace_scope(trace::point, __VA_ARGS__)
+#else
+#define TRACE_THREAD(name) do { } while ( false )
+#define TRACE_EVENT(point, ...) do { } while ( false )
+#define TRACE_SCOPE(point, ...) do { } while ( false )
+#endif
+
+#endif
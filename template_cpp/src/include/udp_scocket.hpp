@@ -20,7 +20,7 @@ public:
 class UDPSocket{
     private:
         int sockfd; //socket file descriptor
-        char buffer_received[packet::MAX_LENGTH];
+        char buffer_received[packet::MAX_DATAGRAM_LENGTH];
         char buffer_send[packet::MAX_LENGTH];
         struct sockaddr_in address;
         int timeout_sec;
@@ -39,6 +39,12 @@ class UDPSocket{
 
         void send(packet::Packet p, const sockaddr * dest);
 
+        /* blocks execution until a datagram arrives, copies it into buffer (of size max_length)
+           and returns its length */
+        std::size_t receiveBytes(char * buffer, std::size_t max_length);
+
+        void sendBytes(const char * buffer, std::size_t length, const sockaddr * dest);
+
 
         void closeConnection(){
           close(sockfd);
@@ -8,7 +8,14 @@
 #include <mutex>
 #include "causal_broadcast.hpp"
 #include "thread_safe_queue.hpp"
+#include "process_set.hpp"
+#include "sequence_set.hpp"
+#include "settings.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <thread>
+#include <chrono>
+#include <sstream>
 
 
 using namespace packet;
@@ -16,26 +23,133 @@ using namespace packet;
 class BestEffortBroadcast;
 class CausalBroadcast;
 
+// digest mode: packet announced by other processes, whose payload was not received yet
+struct MissingPayload{
+    std::vector<std::size_t> holders;   // processes that announced to have the payload
+    std::chrono::steady_clock::time_point first_seen;
+    std::chrono::steady_clock::time_point last_pull;
+    std::size_t num_pulls = 0;
+};
+
+
+// tree mode: state of a packet in the tree rooted at its source
+struct TreeState{
+    std::map<std::size_t, std::size_t> child_counts;    // child id -> processes of its subtree holding the packet
+    std::size_t reported = 0;       // count last reported to the parent
+    bool stable = false;            // a majority holds the packet (known from the root)
+    bool complete = false;          // every process holds the packet (known from the root)
+    bool flat = false;              // fallen back to digest mode: have records are exchanged with every process
+    std::chrono::steady_clock::time_point held_since;
+};
+
+
+// URB state of the sources with source_id % num_shards equal to the index of the shard
+struct URBShard{
+    std::mutex mutex;
+
+    // delivered[source_id] returns the set of sequence numbers of delivered packets
+    std::map<std::size_t, SequenceSet> delivered;
+
+    // pending[source_id] returns set of packet_seq_num of pending packets
+    std::map<std::size_t, std::set<std::size_t>> pending;
+
+    // acks[source_id][seq_num] returns set of processes that have re-sent the packet with corresponding
+    // source_id, packet_seq_num. The entry is removed when the packet is delivered (digest mode: when it
+    // is reclaimed), and relays of delivered packets are ignored, so it only holds packets in flight
+    std::map<std::size_t, std::map<std::size_t, ProcessSet>> acks;
+
+    // digest mode: held[source_id][seq_num] is the payload of a packet, kept to answer pulls
+    std::map<std::size_t, std::map<std::size_t, Packet>> held;
+
+    // digest mode: missing[source_id][seq_num] is a packet announced by others but not received
+    std::map<std::size_t, std::map<std::size_t, MissingPayload>> missing;
+
+    // tree mode: tree[source_id][seq_num] is the state of the packet in the tree of source_id
+    std::map<std::size_t, std::map<std::size_t, TreeState>> tree;
+};
+
+
+/*
+In the default mode every process re-broadcasts the payload of every packet the first time it receives it.
+In digest mode (DA_URB_RELAY=digest) a process that receives a payload only broadcasts a "have" record
+(source_id, seq_num), in control packets with source_id CONTROL_SOURCE. A have from a process counts as its ack,
+so the majority rule is unchanged, but a packet is delivered only once its payload is held.
+A process that has a have but not the payload pulls it from one of the holders (round robin) if the origin is
+suspected, or if the payload did not arrive within pull_timeout. Holders keep payloads until every process
+announced to have them: suspicions may be wrong, a process suspected only because it was slow must still be
+able to pull the payload once the origin crashed.
+
+In tree mode (DA_URB_RELAY=tree) payloads and acks follow a DA_URB_TREE_FANOUT-ary tree rooted at the source
+(process ids ordered starting from the source). A process forwards the payload to its children, and reports to
+its parent how many processes of its subtree hold it, once the whole subtree does (or after tree_report_timeout).
+The root marks the packet stable when a majority holds it, and complete when every process does, and both
+are forwarded down the tree: a process delivers a packet held and stable. A process that holds a packet not
+complete after tree_fallback_timeout (crashed or slow processes) falls back to digest mode for that packet,
+and the others join as soon as they receive its have record (processes that already reclaimed the packet answer
+with a delivered record, that counts as an ack). Each process sends and receives O(fanout) packets per message
+instead of O(N).
+
+In every mode, each process periodically sends to the others the number of packets of each source it delivered
+(contiguous prefix). The minimum over all the processes is the stability watermark: the packets below it were
+delivered everywhere, their state is dropped by URB and by the perfect link. Suspected processes are not skipped,
+a wrong suspicion would drop payloads that a slow process still has to pull (the watermark stops at the last
+prefix announced by a crashed process).
+
+The state is partitioned by source_id in shards with their own lock, so that packets of different
+sources can be processed in parallel by the BEB deliver workers (lock order: shard, then digest_mutex)
+*/
 class UniformReliableBroadcast{
 
     private:
         std::size_t process_id;
 
-        // delivered[source_id] returns the set of sequence numbers of delivered packets
-        std::map<std::size_t, std::set<std::size_t>> delivered;
+        static const std::size_t CONTROL_SOURCE = 0;
+        // control records
+        static const std::size_t HAVE = 0;      // HAVE source_id seq_num
+        static const std::size_t PULL = 1;      // PULL holder_id source_id seq_num, the holder sends the payload to the sender
+        static const std::size_t SUBTREE = 2;   // SUBTREE source_id seq_num count, to the parent
+        static const std::size_t STABLE = 3;    // STABLE source_id seq_num, to the children
+        static const std::size_t COMPLETE = 4;  // COMPLETE source_id seq_num, to the children
+        static const std::size_t DELIVERED = 5; // DELIVERED source_id seq_num, answer to a have for a reclaimed packet
+        static const std::size_t STABILITY = 6; // STABILITY n_1 ... n_N, the sender delivered the first n_i packets of source i
 
-        // called by BEBDeliver(), broadcast() to access pending
-        std::mutex pending_mutex;
+        enum RelayMode{FULL, DIGEST, TREE};
+        RelayMode relay_mode;
 
-        // pending[source_id] returns set of packet_seq_num of pending packets
-        std::map<std::size_t, std::set<std::size_t>> pending;
-        
-        // acks[source_id][seq_num] returns set of processes that have re-sent the packet with corresponding
-        // source_id, packet_seq_num 
-        std::map<std::size_t, std::map<std::size_t, std::set<std::size_t>>> acks;
+        const std::chrono::milliseconds pull_timeout = std::chrono::milliseconds(settings::getSize("URB_PULL_TIMEOUT_MS", 1000));
+        const std::size_t tree_fanout = std::max(settings::getSize("URB_TREE_FANOUT", 4), std::size_t(1));
+        const std::chrono::milliseconds tree_report_timeout = std::chrono::milliseconds(settings::getSize("URB_TREE_REPORT_MS", 200));
+        const std::chrono::milliseconds tree_fallback_timeout = std::chrono::milliseconds(settings::getSize("URB_TREE_FALLBACK_MS", 2000));
+        const std::chrono::milliseconds repair_period = std::chrono::milliseconds(100);
+        const std::chrono::milliseconds reclaim_period = std::chrono::seconds(1);
+        // 0 disables the stability watermark
+        const std::chrono::milliseconds stability_period = std::chrono::milliseconds(settings::getSize("STABILITY_PERIOD_MS", 1000));
 
         std::size_t num_processes;
 
+        const std::size_t num_shards = std::max(settings::getSize("URB_SHARDS", 16), std::size_t(1));
+        std::vector<URBShard> shards = std::vector<URBShard>(num_shards);
+
+        URBShard & getShard(std::size_t source_id){
+            return shards[source_id % num_shards];
+        }
+
+        // digest and tree modes: control packets being filled with records for each destination, sent when
+        // full or when there is nothing else to process. Control packets are numbered per destination, so that
+        // the perfect link of every receiver sees a contiguous sequence from this process
+        std::mutex digest_mutex;
+        std::map<std::size_t, Packet> control_packets;
+        std::map<std::size_t, std::size_t> control_seq_nums;
+
+        // delivered_prefixes[process_id][i] is the number of packets of source i + 1 delivered by process_id,
+        // as last announced (or computed for this process)
+        std::mutex stability_mutex;
+        std::map<std::size_t, std::vector<std::size_t>> delivered_prefixes;
+        std::vector<std::size_t> watermark;
+
+        // tree mode: number of processes in the subtree of the process with rank i (position from the root)
+        std::vector<std::size_t> subtree_sizes;
+
         // lower level abstraction
         BestEffortBroadcast* beb = NULL;
 
@@ -46,24 +160,83 @@ class UniformReliableBroadcast{
         // that checks if packets can be URBDelivered
         ThreadSafeQueue<Packet> packets_to_deliver;
 
+        metrics::Counter & relayed = metrics::counter("urb_relayed");               // payloads re-broadcast or forwarded in the tree
+        metrics::Counter & late_relays = metrics::counter("urb_late_relays");       // payloads received after the delivery
+        metrics::Counter & pulls_sent = metrics::counter("urb_pulls_sent");
+        metrics::Counter & pulls_answered = metrics::counter("urb_pulls_answered");
+        metrics::Counter & delivered_packets = metrics::counter("urb_delivered");
+
         // checks if packet was retransmitted by a majority of processes (looking at number of acks)
-        bool canDeliver(std::size_t source_id, std::size_t seq_num);
+        bool canDeliver(URBShard & shard, std::size_t source_id, std::size_t seq_num);
 
         // permanent thread consuming packets_to_deliver
         void URBDeliver();        
 
+        // full mode
+        void receiveRelay(Packet & p, std::vector<Packet> & ready);
+
+        // digest and tree modes
+        void receivePayload(Packet & p, std::vector<Packet> & ready);
+        void receiveDigest(Packet & p, std::vector<Packet> & ready);
+        // the lock of shard is held by the callers of the next functions
+        void receiveHave(URBShard & shard, std::size_t sender_id, std::size_t source_id, std::size_t seq_num,
+                         std::vector<Packet> & ready, std::chrono::steady_clock::time_point now);
+        // adds the payload to ready if it can be delivered
+        void deliverIfReady(URBShard & shard, std::size_t source_id, std::size_t seq_num, std::vector<Packet> & ready);
+        // forgets a delivered packet once every process announced it (or the tree marked it complete)
+        void reclaimIfComplete(URBShard & shard, std::size_t source_id, std::size_t seq_num);
+        void pull(std::size_t source_id, std::size_t seq_num, MissingPayload & missing_payload,
+                  std::chrono::steady_clock::time_point now);
+        // tree mode: reports the count of the subtree to the parent, or marks the packet stable/complete at the root
+        void treeProgress(URBShard & shard, std::size_t source_id, std::size_t seq_num, bool force_report);
+        // tree mode: from now on the packet is announced to every process (digest mode) instead of using the tree
+        void fallBack(URBShard & shard, std::size_t source_id, std::size_t seq_num);
+        // tree mode: records STABLE, COMPLETE and DELIVERED
+        void receiveTreeRecord(URBShard & shard, std::size_t type, std::size_t sender_id, std::size_t source_id,
+                               std::size_t seq_num, std::vector<Packet> & ready);
+
+        // tree of source_id: processes are ordered starting from source_id, the process with rank r
+        // has the processes with rank r * tree_fanout + 1 ... r * tree_fanout + tree_fanout as children
+        std::size_t treeRank(std::size_t id, std::size_t source_id){
+            return (id + num_processes - source_id) % num_processes;
+        }
+        std::size_t treeId(std::size_t rank, std::size_t source_id){
+            return (source_id - 1 + rank) % num_processes + 1;
+        }
+        std::vector<std::size_t> treeChildren(std::size_t id, std::size_t source_id);
+        std::size_t treeParent(std::size_t id, std::size_t source_id){
+            return treeId((treeRank(id, source_id) - 1) / tree_fanout, source_id);
+        }
+
+        // stability watermark: announces the delivered prefixes of this process, and forgets the packets
+        // delivered by every process, in every layer
+        void announceDeliveredPrefixes();
+        void receiveDeliveredPrefixes(std::size_t sender_id, std::istringstream & record);
+        void trimStable();
+
+        // take digest_mutex
+        void addRecord(std::size_t dest_id, std::string record);
+        void addRecord(std::vector<std::size_t> dest_ids, std::string record);
+        // record for every other process
+        void addRecordToAll(std::string record);
+        void flushDigest();
+
+        // pulls the missing payloads, sends the partial tree reports, falls back to digest mode (digest and tree modes),
+        // flushes the control packets, reclaims delivered packets and updates the stability watermark
+        // periodically (1 permanent thread)
+        void repair();
+
 
     public:
 
-        UniformReliableBroadcast(std::size_t i_process_id, std::size_t i_num_processes) : 
-        process_id(i_process_id), num_processes(i_num_processes){}
+        UniformReliableBroadcast(std::size_t i_process_id, std::size_t i_num_processes);
 
         
-        // contains active threads (URBDeliver)
+        // contains active threads (URBDeliver, repair)
         std::vector<std::thread *> threads;
 
         // deliver function invoked by Best Effort Broadcast 
-        // (lower level abstraction)
+        // (lower level abstraction), by several threads at once for different sources
         void BEBDeliver(Packet p);
 
         void setBEB(BestEffortBroadcast* i_beb){
@@ -76,6 +249,15 @@ class UniformReliableBroadcast{
 
         void broadcast(Packet p);
 
+        // number of packets whose acks are tracked (received but not yet delivered)
+        std::size_t getNumTrackedPackets();
+
+        // number of packets of each source delivered by every process
+        std::vector<std::size_t> getStabilityWatermark(){
+            std::unique_lock<std::mutex> lock(stability_mutex);
+            return watermark;
+        }
+
         // begins execution of threads and adds them to threads
         void start();
 
@@ -1,28 +1,111 @@
 #ifndef VECTOR_CLOCK_H
 #define VECTOR_CLOCK_H
 
-#include <vector>
+#include <array>
+#include <set>
+#include <algorithm>
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
 #include <assert.h>
 #include "debug.h"
+#include "clock_kernels.hpp"
+#include "process_set.hpp"
 
+/*
+Values are stored as 32-bit counters (packet sequence numbers) in a fixed width array of MAX_PROCESSES
+entries, so clocks are never allocated on the heap. The entries after num_processes are 0, so clocks
+are compared on the smallest fixed width (8, 16, 32, 64 or 128) that holds num_processes, with the
+kernels specialized at compile time for that width (see clock_kernels::configure).
+
+A sparse clock carries only the entries of a set of processes (the dependencies of the sender in
+localized causal broadcast), the others are 0: it is compared only on those entries, and encoded as
+the pairs (id, value) if that is shorter than all the values. The encoding starts with a tag field,
+DENSE_TAG followed by the num_processes values, or SPARSE_TAG and the number of pairs followed by the pairs
+*/
 class VectorClock{
     private:
-        std::size_t num_processes;
-        std::vector<std::size_t> values;
+        static const char DENSE_TAG = 'D';
+        static const char SPARSE_TAG = 'S';
 
-    public:
-        VectorClock(){}
+        std::size_t num_processes = 0;
+        std::size_t width = 0;  // entries passed to the kernels
+        std::array<uint32_t, MAX_PROCESSES> values = {};
+
+        // sparse clocks: ids of the entries carried, ascending
+        bool sparse = false;
+        std::size_t num_carried = 0;
+        std::array<uint8_t, MAX_PROCESSES> carried_ids = {};
 
-        VectorClock(std::size_t i_num_processes): num_processes(i_num_processes){
+        // length of the encoding, computed on demand (0 if not known)
+        mutable std::size_t bytes_length = 0;
+
+        // the clock changed: it is dense, unless only an entry of id (carried) changed
+        void changed(std::size_t id_process){
+            bytes_length = 0;
+            if (sparse && !std::binary_search(carried_ids.data(), carried_ids.data() + num_carried, id_process)){
+                sparse = false;
+            }
+        }
+
+        // true if the clock is encoded as pairs
+        bool isEncodedSparse() const{
+            return sparse && sparseLength() < denseLength();
+        }
+
+        std::size_t denseLength() const{
+            std::size_t dense_length = 2;
             for (std::size_t i = 0; i < num_processes; i++){
-                values.push_back(0);
+                dense_length += numDigits(values[i]) + 1;
+            }
+            return dense_length;
+        }
+
+        std::size_t sparseLength() const{
+            std::size_t sparse_length = 2 + numDigits(static_cast<uint32_t>(num_carried));
+            for (std::size_t i = 0; i < num_carried; i++){
+                sparse_length += numDigits(carried_ids[i]) + numDigits(values[carried_ids[i] - 1U]) + 2;
             }
+            return sparse_length;
         }
 
-        VectorClock(std::size_t i_num_processes, std::size_t * i_values): num_processes(i_num_processes){
+        // writes value and '\0' at cur_pointer, returns the position after them
+        static char * writeField(char * cur_pointer, uint32_t value){
+            cur_pointer = std::to_chars(cur_pointer, cur_pointer + 10, value).ptr;
+            *cur_pointer = '\0';
+            return cur_pointer + 1;
+        }
+
+        // parses the field at cur_pointer in value, returns the position after its '\0'
+        template <typename T>
+        static const char * readField(const char * cur_pointer, T & value){
+            // fields end with '\0', that stops the parsing
+            return std::from_chars(cur_pointer, cur_pointer + 11, value).ptr + 1;
+        }
+
+        // number of decimal digits of value
+        static std::size_t numDigits(uint32_t value){
+            std::size_t digits = 1;
+            while (value >= 10){
+                value /= 10;
+                digits++;
+            }
+            return digits;
+        }
+
+    public:
+        VectorClock(){}
+
+        VectorClock(std::size_t i_num_processes): num_processes(i_num_processes),
+            width(clock_kernels::paddedWidth(i_num_processes)){
+            assert((num_processes <= MAX_PROCESSES) == true);
+        }
+
+        VectorClock(std::size_t i_num_processes, std::size_t * i_values): VectorClock(i_num_processes){
             for (std::size_t i = 0; i < num_processes; i++){
-                values.push_back(i_values[i]);
+                values[i] = static_cast<uint32_t>(i_values[i]);
             }
         }
 
@@ -32,87 +115,145 @@ class VectorClock{
             std::size_t idx = id_process - 1;
             assert((idx < num_processes) == true);
             values[idx] = values[idx] + 1;
+            changed(id_process);
         }
 
 
         void assign(std::size_t id_process, std::size_t val){
             std::size_t idx = id_process - 1;
             assert((idx < num_processes) == true);
-            values[idx] = val;
+            values[idx] = static_cast<uint32_t>(val);
+            changed(id_process);
         }
 
         // 1 <= id_process <= num_processes
-        std::size_t getValue(std::size_t id_process){
+        std::size_t getValue(std::size_t id_process) const{
             assert(((id_process >= 1) && (id_process <= num_processes))==true);
             std::size_t idx = id_process - 1;
-            return values[id_process];
+            return values[idx];
         }
 
+        std::size_t getNumProcesses() const{
+            return num_processes;
+        }
 
-        bool operator <(const VectorClock& v2) const{
-            bool strictly_lower = false;
-            assert((num_processes == v2.num_processes) == true);
-            for (std::size_t i = 0; i < num_processes; i++){
-                if (values[i] > v2.values[i]){
-                    return false;
+        // from now on the clock carries only the entries of ids (the others are set to 0)
+        void restrictTo(const std::set<std::size_t> & ids){
+            num_carried = 0;
+            for (std::size_t id = 1; id <= num_processes; id++){
+                if (ids.count(id) == 1){
+                    carried_ids[num_carried] = static_cast<uint8_t>(id);
+                    num_carried++;
                 }
-                else if (values[i] < v2.values[i]){
-                    strictly_lower = true;
+                else{
+                    values[id - 1] = 0;
                 }
             }
-            return strictly_lower;
+            sparse = true;
+            bytes_length = 0;
+        }
+
+        bool isSparse() const{
+            return sparse;
+        }
+
+
+        bool operator <(const VectorClock& v2) const{
+            assert((num_processes == v2.num_processes) == true);
+            return clock_kernels::lessThan(values.data(), v2.values.data(), width);
         }
 
 
         bool operator <= (const VectorClock& v2) const{
             assert((num_processes == v2.num_processes) == true);
-            for (std::size_t i = 0; i < num_processes; i++){
-                if (values[i] > v2.values[i]){
-                    return false;
+            return clock_kernels::firstGreater(values.data(), v2.values.data(), 0, width) == width;
+        }
+
+        // id of the first process from from_id on whose entry is greater than in v2, num_processes + 1 if there is none
+        std::size_t firstGreater(const VectorClock& v2, std::size_t from_id) const{
+            assert((num_processes == v2.num_processes) == true);
+            if (sparse){
+                const uint8_t * carried_end = carried_ids.data() + num_carried;
+                for (const uint8_t * id = std::lower_bound(carried_ids.data(), carried_end, from_id); id != carried_end; id++){
+                    if (values[*id - 1U] > v2.values[*id - 1U]){
+                        return *id;
+                    }
                 }
+                return num_processes + 1;
             }
-            return true;
+            std::size_t idx = clock_kernels::firstGreater(values.data(), v2.values.data(), from_id - 1, width);
+            return idx < num_processes ? idx + 1 : num_processes + 1;
+        }
+
+        // entry-wise max
+        void merge(const VectorClock& v2){
+            assert((num_processes == v2.num_processes) == true);
+            clock_kernels::merge(values.data(), v2.values.data(), width);
+            changed(0);
         }
 
-        // writes vector clock values separated by '\0' as char representation to buffer,
-        // returns number of bytes written
-        std::size_t toBytes(char * buffer){
+        // adds the entries of increments (batch of increases)
+        void add(const VectorClock& increments){
+            assert((num_processes == increments.num_processes) == true);
+            clock_kernels::add(values.data(), increments.values.data(), width);
+            changed(0);
+        }
+
+        // writes the tag and the vector clock values (or pairs) separated by '\0' as char representation
+        // to buffer, returns number of bytes written
+        std::size_t toBytes(char * buffer) const{
             char* cur_pointer = &buffer[0];
-            std::size_t num_bytes = 0;
-            for (std::size_t i = 0; i < num_processes; i++){
-                const char* cur_val = std::to_string(values[i]).c_str();
-                std::size_t size = std::to_string(values[i]).size() + 1;
-                std::strcpy(cur_pointer, cur_val);
-                cur_pointer += size;
-                num_bytes += size;
+            // buffer has room for getBytesLength() bytes
+            if (isEncodedSparse()){
+                *cur_pointer = SPARSE_TAG;
+                cur_pointer = writeField(cur_pointer + 1, static_cast<uint32_t>(num_carried));
+                for (std::size_t i = 0; i < num_carried; i++){
+                    cur_pointer = writeField(cur_pointer, carried_ids[i]);
+                    cur_pointer = writeField(cur_pointer, values[carried_ids[i] - 1U]);
+                }
+            }
+            else{
+                *cur_pointer = DENSE_TAG;
+                *(cur_pointer + 1) = '\0';
+                cur_pointer += 2;
+                for (std::size_t i = 0; i < num_processes; i++){
+                    cur_pointer = writeField(cur_pointer, values[i]);
+                }
             }
-            return num_bytes;
+            return static_cast<std::size_t>(cur_pointer - buffer);
         }
 
         // return length of bytes representation
-        std::size_t getBytesLength(){
-            std::size_t vc_length = 0;
-            for (std::size_t id = 0; id < num_processes; id++){
-                std::string val_str = std::to_string(values[id]);
-                vc_length += val_str.size() + 1; //NULL char 
+        std::size_t getBytesLength() const{
+            if (bytes_length == 0){
+                bytes_length = sparse ? std::min(sparseLength(), denseLength()) : denseLength();
             }
-            return vc_length;
+            return bytes_length;
         }
 
         // from char* representation to VectorClock
         static VectorClock decodeData(char * data, std::size_t num_processes){
            // DEBUG_MSG("About to decode Vector Clock");
             VectorClock res = VectorClock(num_processes);
-            char* cur_pointer = &data[0];
-            for (std::size_t i = 0; i < num_processes; i++){
-                std::size_t size = 0;
-                while (cur_pointer[size] != '\0'){
-                    size++;
+            const char* cur_pointer = &data[0];
+            if (*cur_pointer == SPARSE_TAG){
+                cur_pointer = readField(cur_pointer + 1, res.num_carried);
+                assert((res.num_carried <= num_processes) == true);
+                for (std::size_t i = 0; i < res.num_carried; i++){
+                    cur_pointer = readField(cur_pointer, res.carried_ids[i]);
+                    assert(((res.carried_ids[i] >= 1) && (res.carried_ids[i] <= num_processes)) == true);
+                    cur_pointer = readField(cur_pointer, res.values[res.carried_ids[i] - 1U]);
+                }
+                res.sparse = true;
+            }
+            else{
+                cur_pointer += 2;
+                for (std::size_t i = 0; i < num_processes; i++){
+                    cur_pointer = readField(cur_pointer, res.values[i]);
+                   // DEBUG_MSG("Vector clock for process " << i+1 << " is: " << res.values[i]);
                 }
-                res.values[i] = std::stoul(std::string(cur_pointer, size));
-                cur_pointer += size + 1;
-               // DEBUG_MSG("Vector clock for process " << i+1 << " is: " << res.values[i]);
             }
+            res.bytes_length = static_cast<std::size_t>(cur_pointer - data);
             return res;
         }
 
@@ -120,4 +261,4 @@ class VectorClock{
 };
 
 
-#endif
\ No newline at end of file
+#endif
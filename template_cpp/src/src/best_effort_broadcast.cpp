@@ -1,41 +1,92 @@
 #include "best_effort_broadcast.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <algorithm>
 
 
+BestEffortBroadcast::BestEffortBroadcast(PerfectLink* pl, std::vector<Parser::Host> i_hosts):
+    perfect_link(pl), hosts(i_hosts){
+    for (std::size_t i = 0; i < num_deliver_workers; i++){
+        metrics::gauge(metrics::labeled("queue_depth", "queue", "beb_deliver_" + std::to_string(i)),
+                       [this, i] {return packets_to_deliver[i].getSize();});
+    }
+    metrics::gauge(metrics::labeled("queue_depth", "queue", "beb_re_broadcast"),
+                   [this] {return scheduler.getStats()[RE_BROADCAST].depth;});
+    metrics::gauge(metrics::labeled("queue_depth", "queue", "beb_broadcast"),
+                   [this] {return scheduler.getStats()[BROADCAST].depth;});
+}
+
 
-void BestEffortBroadcast::deliver(){
+
+void BestEffortBroadcast::deliver(std::size_t worker_id){
     while(true){
-        Packet p = packets_to_deliver.pop();
+        Packet p = packets_to_deliver[worker_id].pop();
+        TRACE_EVENT(BEB_DELIVER, p.source_id, p.packet_seq_num, p.process_id);
         urb -> BEBDeliver(p);
     }
 }
 
 
 void BestEffortBroadcast::broadcast(){
+    std::vector<std::pair<std::size_t, OutgoingPacket>> batch;
+    auto next_report = std::chrono::steady_clock::now();
     while(true){
-        // it works because this is the only consumer of packets_to_rebroadcast
-        if (packets_to_re_broadcast.getSize() > 0){
-            Packet cur_packet = packets_to_re_broadcast.pop();
-            DEBUG_MSG("BEB RE-Broadcasting: packet source: " <<  cur_packet.source_id << " sender: " << cur_packet.process_id << " seq_num: "  << cur_packet.packet_seq_num);
+        batch.clear();
+        scheduler.popBatch(batch, batch_size);
+        for (auto & class_packet : batch){
+            // the same packet is shared by all the destinations
+            SharedPacket cur_packet = std::make_shared<const Packet>(std::move(class_packet.second.packet));
+            std::vector<std::size_t> & dest_ids = class_packet.second.dest_ids;
+            if (!dest_ids.empty()){
+                DEBUG_MSG("BEB sending to " << dest_ids.size() << " processes: packet source: " <<  cur_packet -> source_id << " seq_num: "  << cur_packet -> packet_seq_num);
+                for (std::size_t dest_id : dest_ids){
+                    perfect_link -> send(Packet_ProcId(cur_packet, dest_id));
+                }
+                continue;
+            }
+            if (class_packet.first == RE_BROADCAST){
+                DEBUG_MSG("BEB RE-Broadcasting: packet source: " <<  cur_packet -> source_id << " sender: " << cur_packet -> process_id << " seq_num: "  << cur_packet -> packet_seq_num);
+            }
+            else{
+                DEBUG_MSG("BEB Broadcasting: packet seq_num: "  << cur_packet -> packet_seq_num);
+            }
             for (auto host : hosts){
                 perfect_link -> send(Packet_ProcId(cur_packet, host.id));
             }
         }
-        // it works because this is the only consumer of packets_to_broadcast
-        if(packets_to_broadcast.getSize() > 0){
-            Packet cur_packet = packets_to_broadcast.pop();
-            DEBUG_MSG("BEB Broadcasting: packet seq_num: "  << cur_packet.packet_seq_num);
-            for (auto host : hosts){
-                perfect_link -> send(Packet_ProcId(cur_packet, host.id));
+
+        if (std::chrono::steady_clock::now() >= next_report){
+            next_report = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            std::vector<SchedulerClassStats> stats = scheduler.getStats();
+            for (std::size_t i = 0; i < stats.size(); i++){
+                DEBUG_MSG("BEB queue: " << (i == RE_BROADCAST ? "re-broadcast" : "broadcast") << " depth: " << stats[i].depth
+                          << " max depth: " << stats[i].max_depth << " popped: " << stats[i].popped
+                          << " producer waits: " << stats[i].producer_waits << " starved: " << stats[i].starved
+                          << " max wait ms: " << std::chrono::duration_cast<std::chrono::milliseconds>(stats[i].max_wait).count());
             }
+            std::vector<std::size_t> watermark = urb -> getStabilityWatermark();
+            DEBUG_MSG("URB packets with tracked acks: " << urb -> getNumTrackedPackets() << " stability watermark (min over sources): "
+                      << (watermark.empty() ? 0 : *std::min_element(watermark.begin(), watermark.end())));
         }
     }
 }
 
-void BestEffortBroadcast::start(){
-    std::thread * deliver_thread = new std::thread([this] {this -> deliver();});
-    std::thread * broadcast_thread = new std::thread([this] {this -> broadcast();});
+bool BestEffortBroadcast::isSuspected(std::size_t process_id){
+    return perfect_link -> isSuspected(process_id);
+}
 
-    threads.push_back(deliver_thread);
+
+void BestEffortBroadcast::trimDelivered(std::vector<std::size_t> watermark){
+    perfect_link -> trimDelivered(watermark);
+}
+
+
+void BestEffortBroadcast::start(){
+    for (std::size_t worker_id = 0; worker_id < num_deliver_workers; worker_id++){
+        std::thread * deliver_thread = new std::thread([this, worker_id] {TRACE_THREAD("beb_deliver"); this -> deliver(worker_id);});
+        threads.push_back(deliver_thread);
+    }
+    std::thread * broadcast_thread = new std::thread([this] {TRACE_THREAD("beb_broadcast"); this -> broadcast();});
     threads.push_back(broadcast_thread);
 }
 
@@ -8,11 +8,17 @@ CausalBroadcast::CausalBroadcast(ProcessController * i_process_controller, std::
     num_messages = i_num_messages; 
     process_controller = i_process_controller; 
     locality = i_locality;    
+    dependencies = i_locality;
+    dependencies.insert(process_controller->process_id);
     vc_send = VectorClock(hosts.size());
     vc_recv = VectorClock(hosts.size());
-    for (auto host : hosts){
-        next[host.id] = 0;
+    vc_send_bound = VectorClock(hosts.size());
+    for (std::size_t id : dependencies){
+        vc_send_bound.assign(id, num_messages);
     }
+    vc_send_bound.restrictTo(dependencies);
+
+    metrics::gauge("causal_blocked", [this]() noexcept {return num_blocked.load(std::memory_order_relaxed);});
 }
 
 
@@ -20,43 +26,77 @@ VectorClock CausalBroadcast::getSendVectorClock(){
     std::size_t process_id = process_controller->process_id;
     VectorClock vector_clock_send(vc_send);
     vector_clock_send.assign(process_id, cur_seq_num);
+    // the other entries are 0, receivers compare only these ones
+    vector_clock_send.restrictTo(dependencies);
     return vector_clock_send;
         
 }
 
 void CausalBroadcast::URBDeliver(Packet p){
     std::unique_lock<std::mutex> lock(mutex);
-    while(can_broadcast){
-        broadcast_cv.wait(lock);
-    }
     DEBUG_MSG("About to deliver packet " << p.packet_seq_num << " from process: " << p.source_id);
-    pending[p.source_id][p.packet_seq_num] = p;
-    while(pending[p.source_id].count(next[p.source_id]) == 1){
-
-        Packet cur_packet = pending[p.source_id][next[p.source_id]];
-        if (cur_packet.vector_clock <= vc_recv){
-            next[cur_packet.source_id] = next[cur_packet.source_id] + 1;
-            pending[cur_packet.source_id].erase(cur_packet.packet_seq_num);
-            vc_recv.increase(p.source_id);
-            if (locality.count(p.source_id) == 1){
-                vc_send.increase(p.source_id);
-            }
-            causalDeliver(cur_packet);
-        }
-        else{
-            break;
+    std::vector<BlockedPacket> ready;
+    ready.push_back(BlockedPacket{p, 1, std::chrono::steady_clock::now()});
+    while (!ready.empty()){
+        BlockedPacket cur = std::move(ready.back());
+        ready.pop_back();
+        if (!block(cur)){
+            unblock(cur.packet.source_id, ready);
+            wait_latency.recordSince(cur.urb_delivered);
+            causalDeliver(cur.packet);
         }
     }
-   
+}
+
+
+bool CausalBroadcast::block(BlockedPacket & b){
+    b.entry = b.packet.vector_clock.firstGreater(vc_recv, b.entry);
+    if (b.entry > num_processes){
+        return false;
+    }
+    std::size_t id = b.entry;
+    std::size_t needed = b.packet.vector_clock.getValue(id);
+    blocked[id][needed].push_back(std::move(b));
+    num_blocked.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+
+void CausalBroadcast::unblock(std::size_t source_id, std::vector<BlockedPacket> & ready){
+    vc_recv.increase(source_id);
+    if (locality.count(source_id) == 1){
+        vc_send.increase(source_id);
+    }
+    auto waiting_source = blocked.find(source_id);
+    if (waiting_source == blocked.end()){
+        return;
+    }
+    auto waiting = waiting_source->second.find(vc_recv.getValue(source_id));
+    if (waiting == waiting_source->second.end()){
+        return;
+    }
+    num_blocked.fetch_sub(waiting->second.size(), std::memory_order_relaxed);
+    for (BlockedPacket & b : waiting->second){
+        ready.push_back(std::move(b));
+    }
+    waiting_source->second.erase(waiting);
+    if (waiting_source->second.empty()){
+        blocked.erase(waiting_source);
+    }
 }
 
 void CausalBroadcast::causalDeliver(Packet p){
     DEBUG_MSG("CAUSAL: about to deliver packet: " <<  p.source_id << " " << p.packet_seq_num);
-    // if I deliver the packet I broadcasted I can broadcast the next one
+    TRACE_EVENT(CAUSAL_DELIVER, p.source_id, p.packet_seq_num);
     process_controller -> onPacketDelivered(p);
-    if (p.source_id == process_controller ->process_id && (!end_broadcast)){
-        can_broadcast = true;
-        broadcast_cv.notify_all();
+    // if I deliver a packet I broadcasted the window has room for the next one
+    if (p.source_id == process_controller ->process_id){
+        num_own_delivered++;
+        own_delivery_latency.recordSince(own_broadcast_times.front());
+        own_broadcast_times.pop_front();
+        if (cur_seq_num - num_own_delivered < window){
+            broadcast_cv.notify_all();
+        }
     }
     
 }
@@ -65,61 +105,58 @@ void CausalBroadcast::causalDeliver(Packet p){
 void CausalBroadcast::broadcast(){
     assert ((urb != NULL) == true);
     DEBUG_MSG("number of packets to send: " << num_messages << "\n");
-    unsigned long int process_id = process_controller -> process_id;
-
-    std::unique_lock lock(mutex);
 
     // create and send Packets
-    VectorClock vector_clock_send = getSendVectorClock();
-
-    Packet curr_packet(process_id, process_id, cur_seq_num, num_processes, vector_clock_send);
-    for (std::size_t i = 1; i <= num_messages; i++){
-        Message curr_message(std::to_string(i));
+    std::size_t next_message = 1;
+    while (next_message <= num_messages){
+        // the messages are added without the mutex, so that deliveries do not wait for them
+        Packet curr_packet = nextPacket(next_message);
 
-        while(!can_broadcast){
+        std::unique_lock<std::mutex> lock(mutex);
+        while (cur_seq_num - num_own_delivered >= window){
             broadcast_cv.wait(lock);
         }
+        stampPacket(curr_packet);
+        lock.unlock();
+
+        DEBUG_MSG("FIFO: trying to urb broadcast packet, seq_num: " << curr_packet.packet_seq_num << "\n");
+        urb -> broadcast(curr_packet);
+    }
+    DEBUG_MSG("Finished broadcasting");
+}
 
+
+
+Packet CausalBroadcast::nextPacket(std::size_t & next_message){
+    std::size_t process_id = process_controller -> process_id;
+    // only this thread writes cur_seq_num
+    Packet packet(process_id, process_id, cur_seq_num, num_processes, vc_send_bound);
+    while (next_message <= num_messages){
+        Message curr_message(std::to_string(next_message));
         // packet is full (leave a margin of 5 bytes to change the process_id when re-broadcasting messages)
-        if (!curr_packet.canAddMessage(curr_message, 5)){  
-            DEBUG_MSG("FIFO: trying to urb broadcast packet, seq_num: " << curr_packet.packet_seq_num << "\n");
-            process_controller -> onPacketBroadcast(curr_packet);
-            // set before because otherwise I could execute the delivery and then set this variable to false again
-            // having a deadlock
-            can_broadcast = false;   
-            urb -> broadcast(curr_packet);
-            cur_seq_num++;
-
-            broadcast_cv.notify_all();  //broadcasted, so I wake up deliver thread
-            while(!can_broadcast){
-                broadcast_cv.wait(lock);
-            }
-
-            vector_clock_send = getSendVectorClock();
-            curr_packet = Packet(process_id, process_id, cur_seq_num, num_processes, vector_clock_send);
-        }
-        curr_packet.addMessage(curr_message);
-
-        // last message, so send packet even if not full
-        if (i == num_messages){ 
-            DEBUG_MSG("FIFO: trying to urb broadcast packet, seq_num: " << curr_packet.packet_seq_num << "\n");
-            process_controller -> onPacketBroadcast(curr_packet);
-            // set before because otherwise I could execute the delivery and then set this variable to false again
-            // having a deadlock
-            can_broadcast = false;
-            end_broadcast = true;
-            urb -> broadcast(curr_packet);
-            cur_seq_num++;
-            broadcast_cv.notify_all();
+        if (!packet.canAddMessage(curr_message, 5)){
+            break;
         }
+        packet.addMessage(curr_message);
+        next_message++;
     }
-    DEBUG_MSG("Finished broadcasting");
+    return packet;
 }
 
 
+void CausalBroadcast::stampPacket(Packet & packet){
+    // the clock is not longer than vc_send_bound, the packet still fits
+    packet.vector_clock = getSendVectorClock();
+    assert((packet.getLength() <= MAX_LENGTH) == true);
+    process_controller -> onPacketBroadcast(packet);
+    TRACE_EVENT(BROADCAST, packet.source_id, packet.packet_seq_num);
+    own_broadcast_times.push_back(std::chrono::steady_clock::now());
+    cur_seq_num++;
+}
+
 
 void CausalBroadcast::start(){
-    std::thread * broadcast_thread = new std::thread([this] {this -> broadcast();});
+    std::thread * broadcast_thread = new std::thread([this] {TRACE_THREAD("causal_broadcast"); this -> broadcast();});
 
     threads.push_back(broadcast_thread);
 }
\ No newline at end of file
@@ -0,0 +1,384 @@
+#include "clock_kernels.hpp"
+#include "settings.hpp"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CLOCK_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define CLOCK_KERNELS_X86 0
+#endif
+
+using namespace clock_kernels;
+
+
+namespace{
+
+// the kernels are inlined in their fixed width instantiations, where the length is a constant
+#define CLOCK_KERNEL inline __attribute__((always_inline))
+
+CLOCK_KERNEL std::size_t firstGreaterScalar(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t n){
+    for (std::size_t i = from; i < n; i++){
+        if (a[i] > b[i]){
+            return i;
+        }
+    }
+    return n;
+}
+
+CLOCK_KERNEL bool lessThanScalar(const uint32_t * a, const uint32_t * b, std::size_t n){
+    bool strictly_lower = false;
+    for (std::size_t i = 0; i < n; i++){
+        if (a[i] > b[i]){
+            return false;
+        }
+        strictly_lower = strictly_lower || a[i] < b[i];
+    }
+    return strictly_lower;
+}
+
+CLOCK_KERNEL void mergeScalar(uint32_t * a, const uint32_t * b, std::size_t n){
+    for (std::size_t i = 0; i < n; i++){
+        a[i] = std::max(a[i], b[i]);
+    }
+}
+
+CLOCK_KERNEL void addScalar(uint32_t * a, const uint32_t * b, std::size_t n){
+    for (std::size_t i = 0; i < n; i++){
+        a[i] += b[i];
+    }
+}
+
+
+#if CLOCK_KERNELS_X86
+
+/* a <= b on unsigned lanes is max(a, b) == b. The functions are compiled for their instruction set
+   only (target attribute), and called only if the CPU supports it */
+
+__attribute__((target("sse4.1")))
+CLOCK_KERNEL std::size_t firstGreaterSse4(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t n){
+    std::size_t i = from;
+    for (; i + 4 <= n; i += 4){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        int le = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_max_epu32(va, vb), vb)));
+        if (le != 0xF){
+            return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned int>(~le & 0xF)));
+        }
+    }
+    return firstGreaterScalar(a, b, i, n);
+}
+
+__attribute__((target("sse4.1")))
+CLOCK_KERNEL bool lessThanSse4(const uint32_t * a, const uint32_t * b, std::size_t n){
+    std::size_t i = 0;
+    int different = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        if (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_max_epu32(va, vb), vb))) != 0xF){
+            return false;
+        }
+        different |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb))) ^ 0xF;
+    }
+    if (firstGreaterScalar(a, b, i, n) != n){
+        return false;
+    }
+    return different != 0 || lessThanScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+CLOCK_KERNEL void mergeSse4(uint32_t * a, const uint32_t * b, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(a + i), _mm_max_epu32(va, vb));
+    }
+    mergeScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+CLOCK_KERNEL void addSse4(uint32_t * a, const uint32_t * b, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(a + i), _mm_add_epi32(va, vb));
+    }
+    addScalar(a + i, b + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+CLOCK_KERNEL std::size_t firstGreaterAvx2(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t n){
+    std::size_t i = from;
+    for (; i + 8 <= n; i += 8){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        int le = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_max_epu32(va, vb), vb)));
+        if (le != 0xFF){
+            return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned int>(~le & 0xFF)));
+        }
+    }
+    return firstGreaterScalar(a, b, i, n);
+}
+
+__attribute__((target("avx2")))
+CLOCK_KERNEL bool lessThanAvx2(const uint32_t * a, const uint32_t * b, std::size_t n){
+    std::size_t i = 0;
+    int different = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_max_epu32(va, vb), vb))) != 0xFF){
+            return false;
+        }
+        different |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb))) ^ 0xFF;
+    }
+    if (firstGreaterScalar(a, b, i, n) != n){
+        return false;
+    }
+    return different != 0 || lessThanScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+CLOCK_KERNEL void mergeAvx2(uint32_t * a, const uint32_t * b, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), _mm256_max_epu32(va, vb));
+    }
+    mergeScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+CLOCK_KERNEL void addAvx2(uint32_t * a, const uint32_t * b, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), _mm256_add_epi32(va, vb));
+    }
+    addScalar(a + i, b + i, n - i);
+}
+
+#endif
+
+
+struct Kernels{
+    Isa isa;
+    std::size_t width;  // fixed width of the fixed_ versions, 0 if none
+    std::size_t (*first_greater)(const uint32_t *, const uint32_t *, std::size_t, std::size_t);
+    bool (*less_than)(const uint32_t *, const uint32_t *, std::size_t);
+    void (*merge)(uint32_t *, const uint32_t *, std::size_t);
+    void (*add)(uint32_t *, const uint32_t *, std::size_t);
+    std::size_t (*fixed_first_greater)(const uint32_t *, const uint32_t *, std::size_t, std::size_t);
+    bool (*fixed_less_than)(const uint32_t *, const uint32_t *, std::size_t);
+    void (*fixed_merge)(uint32_t *, const uint32_t *, std::size_t);
+    void (*fixed_add)(uint32_t *, const uint32_t *, std::size_t);
+};
+
+const std::size_t FIXED_WIDTHS[] = {8, 16, 32, 64, 128};
+
+
+// instantiations of the kernels for the fixed width N (the length passed is ignored)
+template <std::size_t N>
+std::size_t firstGreaterScalarFixed(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t){
+    return firstGreaterScalar(a, b, from, N);
+}
+template <std::size_t N>
+bool lessThanScalarFixed(const uint32_t * a, const uint32_t * b, std::size_t){
+    return lessThanScalar(a, b, N);
+}
+template <std::size_t N>
+void mergeScalarFixed(uint32_t * a, const uint32_t * b, std::size_t){
+    mergeScalar(a, b, N);
+}
+template <std::size_t N>
+void addScalarFixed(uint32_t * a, const uint32_t * b, std::size_t){
+    addScalar(a, b, N);
+}
+
+#if CLOCK_KERNELS_X86
+
+template <std::size_t N> __attribute__((target("sse4.1")))
+std::size_t firstGreaterSse4Fixed(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t){
+    return firstGreaterSse4(a, b, from, N);
+}
+template <std::size_t N> __attribute__((target("sse4.1")))
+bool lessThanSse4Fixed(const uint32_t * a, const uint32_t * b, std::size_t){
+    return lessThanSse4(a, b, N);
+}
+template <std::size_t N> __attribute__((target("sse4.1")))
+void mergeSse4Fixed(uint32_t * a, const uint32_t * b, std::size_t){
+    mergeSse4(a, b, N);
+}
+template <std::size_t N> __attribute__((target("sse4.1")))
+void addSse4Fixed(uint32_t * a, const uint32_t * b, std::size_t){
+    addSse4(a, b, N);
+}
+
+template <std::size_t N> __attribute__((target("avx2")))
+std::size_t firstGreaterAvx2Fixed(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t){
+    return firstGreaterAvx2(a, b, from, N);
+}
+template <std::size_t N> __attribute__((target("avx2")))
+bool lessThanAvx2Fixed(const uint32_t * a, const uint32_t * b, std::size_t){
+    return lessThanAvx2(a, b, N);
+}
+template <std::size_t N> __attribute__((target("avx2")))
+void mergeAvx2Fixed(uint32_t * a, const uint32_t * b, std::size_t){
+    mergeAvx2(a, b, N);
+}
+template <std::size_t N> __attribute__((target("avx2")))
+void addAvx2Fixed(uint32_t * a, const uint32_t * b, std::size_t){
+    addAvx2(a, b, N);
+}
+
+#endif
+
+
+template <std::size_t N>
+Kernels kernelsFor(Isa isa){
+#if CLOCK_KERNELS_X86
+    // below 32 entries the AVX2 versions are slower than the SSE4.1 ones (measured with clock_bench)
+    if (isa == AVX2 && N < 32){
+        return Kernels{AVX2, N, firstGreaterAvx2, lessThanAvx2, mergeAvx2, addAvx2,
+                       firstGreaterSse4Fixed<N>, lessThanSse4Fixed<N>, mergeSse4Fixed<N>, addSse4Fixed<N>};
+    }
+    if (isa == AVX2){
+        return Kernels{AVX2, N, firstGreaterAvx2, lessThanAvx2, mergeAvx2, addAvx2,
+                       firstGreaterAvx2Fixed<N>, lessThanAvx2Fixed<N>, mergeAvx2Fixed<N>, addAvx2Fixed<N>};
+    }
+    if (isa == SSE4){
+        return Kernels{SSE4, N, firstGreaterSse4, lessThanSse4, mergeSse4, addSse4,
+                       firstGreaterSse4Fixed<N>, lessThanSse4Fixed<N>, mergeSse4Fixed<N>, addSse4Fixed<N>};
+    }
+#endif
+    return Kernels{SCALAR, N, firstGreaterScalar, lessThanScalar, mergeScalar, addScalar,
+                   firstGreaterScalarFixed<N>, lessThanScalarFixed<N>, mergeScalarFixed<N>, addScalarFixed<N>};
+}
+
+Kernels kernelsFor(Isa isa, std::size_t width){
+    switch (width){
+        case 8:
+            return kernelsFor<8>(isa);
+        case 16:
+            return kernelsFor<16>(isa);
+        case 32:
+            return kernelsFor<32>(isa);
+        case 64:
+            return kernelsFor<64>(isa);
+        case 128:
+            return kernelsFor<128>(isa);
+        default:{
+            // the fixed versions are never used
+            Kernels generic = kernelsFor<8>(isa);
+            generic.width = 0;
+            return generic;
+        }
+    }
+}
+
+// best version supported, or the one forced by DA_CLOCK_KERNELS
+Isa defaultIsa(){
+    std::string forced = settings::getString("CLOCK_KERNELS", "");
+    if (forced == "scalar"){
+        return SCALAR;
+    }
+    if (forced == "sse4" && isSupported(SSE4)){
+        return SSE4;
+    }
+    if (forced == "avx2" && isSupported(AVX2)){
+        return AVX2;
+    }
+    if (isSupported(AVX2)){
+        return AVX2;
+    }
+    return isSupported(SSE4) ? SSE4 : SCALAR;
+}
+
+Kernels & kernels(){
+    static Kernels selected = kernelsFor(defaultIsa(), 0);
+    return selected;
+}
+
+}
+
+
+std::size_t clock_kernels::paddedWidth(std::size_t num_processes){
+    for (std::size_t width : FIXED_WIDTHS){
+        if (num_processes <= width){
+            return width;
+        }
+    }
+    return num_processes;
+}
+
+void clock_kernels::configure(std::size_t num_processes){
+    kernels() = kernelsFor(getIsa(), paddedWidth(num_processes));
+}
+
+std::size_t clock_kernels::getWidth(){
+    return kernels().width;
+}
+
+
+std::size_t clock_kernels::firstGreater(const uint32_t * a, const uint32_t * b, std::size_t from, std::size_t n){
+    Kernels & k = kernels();
+    return n == k.width ? k.fixed_first_greater(a, b, from, n) : k.first_greater(a, b, from, n);
+}
+
+bool clock_kernels::lessThan(const uint32_t * a, const uint32_t * b, std::size_t n){
+    Kernels & k = kernels();
+    return n == k.width ? k.fixed_less_than(a, b, n) : k.less_than(a, b, n);
+}
+
+void clock_kernels::merge(uint32_t * a, const uint32_t * b, std::size_t n){
+    Kernels & k = kernels();
+    n == k.width ? k.fixed_merge(a, b, n) : k.merge(a, b, n);
+}
+
+void clock_kernels::add(uint32_t * a, const uint32_t * b, std::size_t n){
+    Kernels & k = kernels();
+    n == k.width ? k.fixed_add(a, b, n) : k.add(a, b, n);
+}
+
+
+Isa clock_kernels::getIsa(){
+    return kernels().isa;
+}
+
+std::string clock_kernels::getIsaName(Isa isa){
+    switch (isa){
+        case AVX2:
+            return "avx2";
+        case SSE4:
+            return "sse4";
+        case SCALAR:
+        default:
+            return "scalar";
+    }
+}
+
+bool clock_kernels::isSupported(Isa isa){
+#if CLOCK_KERNELS_X86
+    if (isa == AVX2){
+        return __builtin_cpu_supports("avx2");
+    }
+    if (isa == SSE4){
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return isa == SCALAR;
+}
+
+bool clock_kernels::select(Isa isa){
+    if (!isSupported(isa)){
+        return false;
+    }
+    kernels() = kernelsFor(isa, getWidth());
+    return true;
+}
@@ -0,0 +1,63 @@
+#include "failure_detector.hpp"
+#include "debug.h"
+
+
+FailureDetector::PeerState & FailureDetector::getPeer(std::size_t process_id){
+    auto it_peer = peers.find(process_id);
+    if (it_peer != peers.end()){
+        return it_peer -> second;
+    }
+    PeerState & peer = peers[process_id];
+    peer.timeout = initial_timeout;
+    peer.probe_interval = initial_probe_interval;
+    return peer;
+}
+
+
+bool FailureDetector::heardFrom(std::size_t process_id){
+    std::unique_lock<std::mutex> lock(mutex);
+    PeerState & peer = getPeer(process_id);
+    peer.last_heard = std::chrono::steady_clock::now();
+    if (!peer.suspected){
+        return false;
+    }
+    // wrong suspicion, wait longer before suspecting again
+    peer.suspected = false;
+    peer.timeout = peer.timeout * 2;
+    peer.probe_interval = initial_probe_interval;
+    DEBUG_MSG("FAILURE-DETECTOR restored process " << process_id << " new timeout ms: " << peer.timeout.count());
+    return true;
+}
+
+
+bool FailureDetector::checkSilence(std::size_t process_id, std::chrono::steady_clock::time_point now){
+    std::unique_lock<std::mutex> lock(mutex);
+    PeerState & peer = getPeer(process_id);
+    if (peer.suspected || now - peer.last_heard < peer.timeout){
+        return false;
+    }
+    peer.suspected = true;
+    peer.num_suspicions++;
+    peer.probe_interval = initial_probe_interval;
+    peer.next_probe = now + peer.probe_interval;
+    DEBUG_MSG("FAILURE-DETECTOR suspected process " << process_id);
+    return true;
+}
+
+
+bool FailureDetector::isSuspected(std::size_t process_id){
+    std::unique_lock<std::mutex> lock(mutex);
+    return getPeer(process_id).suspected;
+}
+
+
+bool FailureDetector::probeDue(std::size_t process_id, std::chrono::steady_clock::time_point now){
+    std::unique_lock<std::mutex> lock(mutex);
+    PeerState & peer = getPeer(process_id);
+    if (!peer.suspected || now < peer.next_probe){
+        return false;
+    }
+    peer.probe_interval = std::min(peer.probe_interval * 2, max_probe_interval);
+    peer.next_probe = now + peer.probe_interval;
+    return true;
+}
@@ -0,0 +1,350 @@
+#include "fec.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace fec;
+
+
+namespace{
+
+// arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1, addition is xor
+struct GaloisField{
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GaloisField(){
+        unsigned int x = 1;
+        for (unsigned int i = 0; i < 255; i++){
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100){
+                x ^= 0x11d;
+            }
+        }
+        for (unsigned int i = 255; i < 512; i++){
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const{
+        if (a == 0 || b == 0){
+            return 0;
+        }
+        return exp[log[a] + log[b]];
+    }
+
+    uint8_t inv(uint8_t a) const{
+        return exp[255 - log[a]];
+    }
+};
+
+const GaloisField gf;
+
+
+// coefficient of data shard i in parity j of a group of k data shards: Cauchy matrix 1 / (x_j + y_i)
+// with x_j = k + j and y_i = i, every square submatrix is invertible
+uint8_t coefficient(std::size_t k, std::size_t j, std::size_t i){
+    return gf.inv(static_cast<uint8_t>((k + j) ^ i));
+}
+
+
+// dest += coef * src, src is considered padded with zeros up to the length of dest
+void mulAdd(std::string & dest, const std::string & src, uint8_t coef){
+    std::size_t length = std::min(dest.size(), src.size());
+    if (coef == 0){
+        return;
+    }
+    if (coef == 1){
+        for (std::size_t i = 0; i < length; i++){
+            dest[i] = static_cast<char>(dest[i] ^ src[i]);
+        }
+        return;
+    }
+    unsigned int log_coef = gf.log[coef];
+    for (std::size_t i = 0; i < length; i++){
+        uint8_t value = static_cast<uint8_t>(src[i]);
+        if (value != 0){
+            dest[i] = static_cast<char>(static_cast<uint8_t>(dest[i]) ^ gf.exp[log_coef + gf.log[value]]);
+        }
+    }
+}
+
+
+void appendField(std::string & datagram, std::size_t value){
+    datagram += std::to_string(value);
+    datagram.push_back('\0');
+}
+
+
+// reads a '\0' terminated number starting at cur and moves cur after it, returns false if not valid
+bool readField(const char * & cur, const char * end, std::size_t & value){
+    const char * start = cur;
+    while (cur < end && *cur != '\0'){
+        cur++;
+    }
+    if (cur == end || cur == start){
+        return false;
+    }
+    try{
+        value = std::stoul(std::string(start, static_cast<std::size_t>(cur - start)));
+    }
+    catch (std::exception const &){
+        return false;
+    }
+    cur++;
+    return true;
+}
+
+}
+
+
+Encoder::Encoder(std::size_t i_sender_id, std::size_t i_k, std::size_t i_m, std::size_t i_interleave) :
+    sender_id(i_sender_id), k(i_k), m(i_m), interleave(std::max(i_interleave, std::size_t(1)))
+{
+    if (k > MAX_GROUP_SIZE || k + m > 255){
+        throw(std::invalid_argument("FEC: k must be at most " + std::to_string(MAX_GROUP_SIZE) +
+                                    " and k + m at most 255, k: " + std::to_string(k) + " m: " + std::to_string(m) + "\n"));
+    }
+}
+
+
+std::vector<std::string> Encoder::add(std::size_t dest_id, std::size_t lane, PacketId id, const char * bytes, std::size_t length){
+    if (!isEnabled()){
+        return std::vector<std::string>();
+    }
+    std::vector<Group> & dest_groups = groups[dest_id];
+    if (dest_groups.empty()){
+        dest_groups.resize(interleave);
+    }
+    Group & group = dest_groups[lane % interleave];
+    group.shards.push_back(std::string(bytes, length));
+    group.ids.push_back(id);
+    if (group.shards.size() < k){
+        return std::vector<std::string>();
+    }
+    return encode(dest_id, group);
+}
+
+
+std::vector<std::string> Encoder::encode(std::size_t dest_id, Group & group){
+    std::size_t group_id = next_group_ids[dest_id]++;
+    std::size_t group_k = group.shards.size();
+    std::size_t shard_length = 0;
+    for (std::string & shard : group.shards){
+        shard_length = std::max(shard_length, shard.size());
+    }
+
+    std::vector<std::string> datagrams;
+    for (std::size_t j = 0; j < m; j++){
+        std::string parity(shard_length, '\0');
+        for (std::size_t i = 0; i < group_k; i++){
+            mulAdd(parity, group.shards[i], coefficient(group_k, j, i));
+        }
+
+        std::string datagram(1, PARITY_TAG);
+        appendField(datagram, sender_id);
+        appendField(datagram, group_id);
+        appendField(datagram, group_k);
+        appendField(datagram, m);
+        appendField(datagram, j);
+        appendField(datagram, shard_length);
+        for (std::size_t i = 0; i < group_k; i++){
+            appendField(datagram, group.ids[i].first);
+            appendField(datagram, group.ids[i].second);
+            appendField(datagram, group.shards[i].size());
+        }
+        datagram += parity;
+        datagrams.push_back(datagram);
+    }
+
+    parity_sent += m;
+    group.shards.clear();
+    group.ids.clear();
+    return datagrams;
+}
+
+
+std::vector<std::pair<std::size_t, std::string>> Encoder::flush(){
+    std::vector<std::pair<std::size_t, std::string>> datagrams;
+    for (auto it_dest = groups.begin(); it_dest != groups.end(); ++it_dest){
+        for (Group & group : it_dest -> second){
+            if (group.shards.empty()){
+                continue;
+            }
+            for (std::string & datagram : encode(it_dest -> first, group)){
+                datagrams.push_back(std::make_pair(it_dest -> first, datagram));
+            }
+        }
+    }
+    return datagrams;
+}
+
+
+bool Encoder::hasPartialGroups() const{
+    for (auto it_dest = groups.begin(); it_dest != groups.end(); ++it_dest){
+        for (const Group & group : it_dest -> second){
+            if (!group.shards.empty()){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+void Decoder::cache(SenderState & sender, PacketId id, const char * bytes, std::size_t length){
+    if (sender.cache.count(id) == 1){
+        return;
+    }
+    sender.cache[id] = std::string(bytes, length);
+    sender.cache_order.push_back(id);
+    while (sender.cache_order.size() > max_cached_packets){
+        sender.cache.erase(sender.cache_order.front());
+        sender.cache_order.pop_front();
+    }
+}
+
+
+void Decoder::onData(std::size_t sender_id, PacketId id, const char * bytes, std::size_t length){
+    cache(senders[sender_id], id, bytes, length);
+}
+
+
+std::vector<packet::Packet> Decoder::onParity(const char * datagram, std::size_t length){
+    const char * cur = datagram + 1;
+    const char * end = datagram + length;
+    std::size_t sender_id, group_id, k, m, index, shard_length;
+    if (!readField(cur, end, sender_id) || !readField(cur, end, group_id) || !readField(cur, end, k) ||
+        !readField(cur, end, m) || !readField(cur, end, index) || !readField(cur, end, shard_length)){
+        return std::vector<packet::Packet>();
+    }
+    if (k == 0 || k + m > 255 || index >= m){
+        return std::vector<packet::Packet>();
+    }
+
+    std::vector<PacketId> ids;
+    std::vector<std::size_t> lengths;
+    for (std::size_t i = 0; i < k; i++){
+        std::size_t source_id, seq_num, packet_length;
+        if (!readField(cur, end, source_id) || !readField(cur, end, seq_num) || !readField(cur, end, packet_length)){
+            return std::vector<packet::Packet>();
+        }
+        ids.push_back(PacketId(source_id, seq_num));
+        lengths.push_back(packet_length);
+    }
+    if (static_cast<std::size_t>(end - cur) != shard_length){
+        return std::vector<packet::Packet>();
+    }
+
+    SenderState & sender = senders[sender_id];
+    ParityGroup & group = sender.groups[group_id];
+    if (group.ids.empty()){
+        group.k = k;
+        group.m = m;
+        group.shard_length = shard_length;
+        group.ids = ids;
+        group.lengths = lengths;
+    }
+    group.parities[index] = std::string(cur, shard_length);
+
+    bool done = false;
+    std::vector<packet::Packet> rebuilt = recover(sender, group, done);
+    if (done){
+        sender.groups.erase(group_id);
+    }
+    while (sender.groups.size() > max_groups){
+        sender.groups.erase(sender.groups.begin());
+    }
+    return rebuilt;
+}
+
+
+std::vector<packet::Packet> Decoder::recover(SenderState & sender, ParityGroup & group, bool & done){
+    std::vector<packet::Packet> rebuilt;
+    std::vector<std::size_t> missing;
+    for (std::size_t i = 0; i < group.k; i++){
+        if (sender.cache.count(group.ids[i]) == 0){
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty()){
+        done = true;
+        return rebuilt;
+    }
+    if (missing.size() > group.parities.size()){
+        // wait for more parities
+        return rebuilt;
+    }
+
+    // remove the contribution of the received packets from the first t parities
+    std::size_t t = missing.size();
+    std::vector<std::size_t> rows;
+    std::vector<std::string> syndromes;
+    for (auto it_parity = group.parities.begin(); rows.size() < t; ++it_parity){
+        std::string syndrome = it_parity -> second;
+        for (std::size_t i = 0; i < group.k; i++){
+            if (sender.cache.count(group.ids[i]) == 1){
+                mulAdd(syndrome, sender.cache[group.ids[i]], coefficient(group.k, it_parity -> first, i));
+            }
+        }
+        rows.push_back(it_parity -> first);
+        syndromes.push_back(syndrome);
+    }
+
+    // invert the t x t submatrix of the coefficients of the missing packets (Gauss-Jordan)
+    std::vector<std::vector<uint8_t>> a(t, std::vector<uint8_t>(t));
+    std::vector<std::vector<uint8_t>> inv(t, std::vector<uint8_t>(t, 0));
+    for (std::size_t r = 0; r < t; r++){
+        for (std::size_t c = 0; c < t; c++){
+            a[r][c] = coefficient(group.k, rows[r], missing[c]);
+        }
+        inv[r][r] = 1;
+    }
+    for (std::size_t col = 0; col < t; col++){
+        std::size_t pivot = col;
+        while (a[pivot][col] == 0){
+            pivot++;
+        }
+        std::swap(a[pivot], a[col]);
+        std::swap(inv[pivot], inv[col]);
+        uint8_t scale = gf.inv(a[col][col]);
+        for (std::size_t c = 0; c < t; c++){
+            a[col][c] = gf.mul(a[col][c], scale);
+            inv[col][c] = gf.mul(inv[col][c], scale);
+        }
+        for (std::size_t r = 0; r < t; r++){
+            uint8_t factor = a[r][col];
+            if (r == col || factor == 0){
+                continue;
+            }
+            for (std::size_t c = 0; c < t; c++){
+                a[r][c] = static_cast<uint8_t>(a[r][c] ^ gf.mul(factor, a[col][c]));
+                inv[r][c] = static_cast<uint8_t>(inv[r][c] ^ gf.mul(factor, inv[col][c]));
+            }
+        }
+    }
+
+    for (std::size_t c = 0; c < t; c++){
+        std::string data(group.shard_length, '\0');
+        for (std::size_t r = 0; r < t; r++){
+            mulAdd(data, syndromes[r], inv[c][r]);
+        }
+        std::size_t i = missing[c];
+        data.resize(group.lengths[i]);
+        try{
+            packet::Packet p = packet::Packet::decodeData(&data[0]);
+            if (p.source_id == group.ids[i].first && p.packet_seq_num == group.ids[i].second){
+                cache(sender, group.ids[i], data.c_str(), data.size());
+                recovered.fetch_add(1, std::memory_order_relaxed);
+                rebuilt.push_back(p);
+            }
+        }
+        catch (std::exception const &){
+            // corrupted group, the packet will be retransmitted
+        }
+    }
+    done = true;
+    return rebuilt;
+}
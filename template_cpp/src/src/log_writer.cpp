@@ -0,0 +1,193 @@
+#include "log_writer.hpp"
+#include "trace.hpp"
+#include <charconv>
+#include <cerrno>
+#include <ctime>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// used by the signal handler
+static_assert(std::atomic<std::size_t>::is_always_lock_free && std::atomic<bool>::is_always_lock_free,
+              "the log writer needs lock-free atomics");
+
+
+bool LogWriter::open(const std::string & path){
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return fd >= 0;
+}
+
+
+std::size_t LogWriter::ringCapacity(std::size_t requested){
+    std::size_t ring_capacity = 64;
+    while (ring_capacity < requested){
+        ring_capacity *= 2;
+    }
+    return ring_capacity;
+}
+
+
+void LogWriter::append(char type, std::size_t source_id, std::size_t first_msg_seq_num, std::size_t num_messages){
+    // only producers write tail, and they are serialized
+    std::size_t cur_tail = tail.load(std::memory_order_relaxed);
+    while (cur_tail - head.load(std::memory_order_acquire) == capacity){
+        std::this_thread::yield();
+    }
+    ring[cur_tail & (capacity - 1)] = LogRecord{type, static_cast<uint32_t>(source_id),
+                                                static_cast<uint32_t>(num_messages), first_msg_seq_num};
+    tail.store(cur_tail + 1, std::memory_order_release);
+}
+
+
+void LogWriter::format(const LogRecord & record){
+    // longest line: type, space, source id, space, sequence number, newline
+    const std::size_t max_line_length = 2 + 11 + 21;
+    for (std::size_t i = record.first_msg_seq_num; i < record.first_msg_seq_num + record.num_messages; i++){
+        if (buffer.size() - buffer_length < max_line_length){
+            writeBuffer();
+        }
+        char * cur_pointer = buffer.data() + buffer_length;
+        char * end = buffer.data() + buffer.size();
+        *cur_pointer++ = record.type;
+        *cur_pointer++ = ' ';
+        // broadcast lines have no source
+        if (record.type == 'd'){
+            cur_pointer = std::to_chars(cur_pointer, end, record.source_id).ptr;
+            *cur_pointer++ = ' ';
+        }
+        cur_pointer = std::to_chars(cur_pointer, end, i).ptr;
+        *cur_pointer++ = '\n';
+        buffer_length = static_cast<std::size_t>(cur_pointer - buffer.data());
+    }
+}
+
+
+void LogWriter::formatRange(const LogRecord & record){
+    // longest line: type, space, source id, space, 2 sequence numbers separated by a space, newline
+    const std::size_t max_line_length = 2 + 11 + 21 + 21;
+    if (buffer.size() - buffer_length < max_line_length){
+        writeBuffer();
+    }
+    char * cur_pointer = buffer.data() + buffer_length;
+    char * end = buffer.data() + buffer.size();
+    *cur_pointer++ = record.type;
+    *cur_pointer++ = ' ';
+    if (record.type == 'd'){
+        cur_pointer = std::to_chars(cur_pointer, end, record.source_id).ptr;
+        *cur_pointer++ = ' ';
+    }
+    cur_pointer = std::to_chars(cur_pointer, end, record.first_msg_seq_num).ptr;
+    *cur_pointer++ = ' ';
+    cur_pointer = std::to_chars(cur_pointer, end, record.first_msg_seq_num + record.num_messages - 1).ptr;
+    *cur_pointer++ = '\n';
+    buffer_length = static_cast<std::size_t>(cur_pointer - buffer.data());
+}
+
+
+void LogWriter::closeRange(){
+    if (has_range){
+        formatRange(range);
+        has_range = false;
+    }
+}
+
+
+void LogWriter::writeBuffer(){
+    if (buffer_length == 0){
+        return;
+    }
+    TRACE_SCOPE(OUTPUT_WRITE, 0, buffer_length);
+    std::size_t offset = committed.load(std::memory_order_relaxed);
+    std::size_t written = 0;
+    while (written < buffer_length){
+        ssize_t result = pwrite(fd, buffer.data() + written, buffer_length - written,
+                                static_cast<off_t>(offset + written));
+        if (result < 0 && errno == EINTR){
+            continue;
+        }
+        if (result <= 0){
+            // the lines are lost, a partial line is overwritten by the next write
+            buffer_length = 0;
+            return;
+        }
+        written += static_cast<std::size_t>(result);
+    }
+    committed.store(offset + written, std::memory_order_release);
+    buffer_length = 0;
+}
+
+
+bool LogWriter::drain(std::size_t max_records){
+    std::size_t cur_head = head.load(std::memory_order_relaxed);
+    std::size_t cur_tail = tail.load(std::memory_order_acquire);
+    if (cur_head == cur_tail){
+        return false;
+    }
+    cur_tail = std::min(cur_tail, cur_head + max_records);
+    for (std::size_t i = cur_head; i != cur_tail; i++){
+        const LogRecord & record = ring[i & (capacity - 1)];
+        if (!ranges){
+            format(record);
+        }
+        else if (has_range && record.type == range.type && record.source_id == range.source_id
+                 && record.first_msg_seq_num == range.first_msg_seq_num + range.num_messages){
+            range.num_messages += record.num_messages;
+        }
+        else{
+            closeRange();
+            range = record;
+            has_range = true;
+        }
+    }
+    head.store(cur_tail, std::memory_order_release);
+    return true;
+}
+
+
+void LogWriter::write(){
+    // the signal handler never runs on this thread, it waits for its pass in stop()
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    while (true){
+        busy.store(true);
+        if (stopping.load()){
+            busy.store(false);
+            return;
+        }
+        bool drained = drain(drain_batch);
+        if (!drained){
+            closeRange();
+            writeBuffer();
+        }
+        busy.store(false);
+        if (!drained){
+            std::this_thread::sleep_for(idle_sleep);
+        }
+    }
+}
+
+
+void LogWriter::stop(){
+    stopping.store(true);
+    const timespec pause = {0, 100000};
+    while (busy.load()){
+        nanosleep(&pause, NULL);
+    }
+    // the writer thread does not access the ring, the buffer and the file anymore. Producers go on
+    // until the process exits, only the records appended before this point are written
+    std::size_t end = tail.load(std::memory_order_acquire);
+    drain(end - head.load(std::memory_order_relaxed));
+    closeRange();
+    writeBuffer();
+}
+
+
+void LogWriter::start(){
+    std::thread * writer_thread = new std::thread([this] {TRACE_THREAD("log_writer"); this -> write();});
+    threads.push_back(writer_thread);
+}
@@ -16,13 +16,14 @@ static void stop(int) {
   signal(SIGTERM, SIG_DFL);
   signal(SIGINT, SIG_DFL);
 
-  std::cout << "Terminate command received. Closing files\n";
-  std::cout.flush();
+  // only async-signal-safe calls: the other threads may hold locks (of streams, of the heap)
+  const char message[] = "Terminate command received. Closing files\n";
+  write(STDOUT_FILENO, message, sizeof(message) - 1);
 
   PROCESS_CONTROLLER -> stopProcess();
 
-  // exit directly from signal handler
-  exit(0);
+  // exit directly from signal handler, without running the exit handlers
+  _exit(0);
 }
 
 
@@ -0,0 +1,257 @@
+#include "metrics.hpp"
+#include "debug.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+
+
+namespace metrics{
+
+    namespace{
+        // metrics are never removed: layers keep references to them
+        struct Registry{
+            std::mutex mutex;
+            std::map<std::string, std::unique_ptr<Counter>> counters;
+            std::map<std::string, std::unique_ptr<Histogram>> histograms;
+            std::map<std::string, std::function<double()>> gauges;
+        };
+
+        Registry & registry(){
+            static Registry * instance = new Registry();
+            return *instance;
+        }
+
+        void replaceId(std::string & path, std::size_t process_id){
+            std::size_t position = path.find("{id}");
+            if (position != std::string::npos){
+                path.replace(position, 4, std::to_string(process_id));
+            }
+        }
+
+        // name and name{labels} of a histogram line with suffix, e.g. latency_count or latency_count{peer="1"}
+        std::string withSuffix(const std::string & name, const std::string & suffix){
+            std::size_t labels = name.find('{');
+            if (labels == std::string::npos){
+                return name + suffix;
+            }
+            return name.substr(0, labels) + suffix + name.substr(labels);
+        }
+    }
+
+
+    uint64_t Counter::getValue() const{
+        uint64_t value = 0;
+        for (const Shard & shard : shards){
+            value += shard.value.load(std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+
+    uint64_t HistogramSnapshot::quantile(double q) const{
+        if (count == 0){
+            return 0;
+        }
+        uint64_t rank = std::max(static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))), uint64_t(1));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts.size(); i++){
+            seen += counts[i];
+            if (seen >= rank){
+                return std::min(Histogram::bucketUpperBound(i), max);
+            }
+        }
+        return max;
+    }
+
+
+    uint64_t Histogram::bucketUpperBound(std::size_t index){
+        if (index < SUB_BUCKETS){
+            return index;
+        }
+        std::size_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t bucket_width = uint64_t(1) << (exponent - SUB_BUCKET_BITS);
+        uint64_t lower_bound = (SUB_BUCKETS + index % SUB_BUCKETS) * bucket_width;
+        return lower_bound + (bucket_width - 1);
+    }
+
+
+    Histogram::Histogram(){
+        for (Shard & shard : shards){
+            for (std::atomic<uint64_t> & count : shard.counts){
+                count.store(0, std::memory_order_relaxed);
+            }
+            shard.sum.store(0, std::memory_order_relaxed);
+            shard.max.store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+    HistogramSnapshot Histogram::getSnapshot() const{
+        HistogramSnapshot result;
+        result.counts.assign(NUM_BUCKETS, 0);
+        for (const Shard & shard : shards){
+            for (std::size_t i = 0; i < NUM_BUCKETS; i++){
+                uint64_t count = shard.counts[i].load(std::memory_order_relaxed);
+                result.counts[i] += count;
+                result.count += count;
+            }
+            result.sum += shard.sum.load(std::memory_order_relaxed);
+            result.max = std::max(result.max, shard.max.load(std::memory_order_relaxed));
+        }
+        return result;
+    }
+
+
+    Counter & counter(const std::string & name){
+        Registry & cur_registry = registry();
+        std::unique_lock<std::mutex> lock(cur_registry.mutex);
+        std::unique_ptr<Counter> & entry = cur_registry.counters[name];
+        if (!entry){
+            entry.reset(new Counter());
+        }
+        return *entry;
+    }
+
+
+    Histogram & histogram(const std::string & name){
+        Registry & cur_registry = registry();
+        std::unique_lock<std::mutex> lock(cur_registry.mutex);
+        std::unique_ptr<Histogram> & entry = cur_registry.histograms[name];
+        if (!entry){
+            entry.reset(new Histogram());
+        }
+        return *entry;
+    }
+
+
+    void gauge(const std::string & name, std::function<double()> sample){
+        Registry & cur_registry = registry();
+        std::unique_lock<std::mutex> lock(cur_registry.mutex);
+        cur_registry.gauges[name] = sample;
+    }
+
+
+    std::string labeled(const std::string & name, const std::string & label, const std::string & value){
+        std::string pair = label + "=\"" + value + "\"";
+        if (!name.empty() && name.back() == '}'){
+            return name.substr(0, name.size() - 1) + "," + pair + "}";
+        }
+        return name + "{" + pair + "}";
+    }
+
+
+    std::string snapshot(){
+        // gauges take the locks of the layers, that may register metrics with them held:
+        // the registry is copied and sampled without its lock
+        std::vector<std::pair<std::string, Counter *>> counters;
+        std::vector<std::pair<std::string, std::function<double()>>> gauges;
+        std::vector<std::pair<std::string, Histogram *>> histograms;
+        {
+            Registry & cur_registry = registry();
+            std::unique_lock<std::mutex> lock(cur_registry.mutex);
+            for (auto & entry : cur_registry.counters){
+                counters.emplace_back(entry.first, entry.second.get());
+            }
+            gauges.assign(cur_registry.gauges.begin(), cur_registry.gauges.end());
+            for (auto & entry : cur_registry.histograms){
+                histograms.emplace_back(entry.first, entry.second.get());
+            }
+        }
+        std::ostringstream text;
+        // gauges are integers so far, written without exponent
+        text.precision(15);
+        for (auto & entry : counters){
+            text << entry.first << " " << entry.second -> getValue() << "\n";
+        }
+        for (auto & entry : gauges){
+            text << entry.first << " " << entry.second() << "\n";
+        }
+        for (auto & entry : histograms){
+            HistogramSnapshot histogram_snapshot = entry.second -> getSnapshot();
+            text << withSuffix(entry.first, "_count") << " " << histogram_snapshot.count << "\n";
+            text << withSuffix(entry.first, "_sum") << " " << histogram_snapshot.sum << "\n";
+            text << withSuffix(entry.first, "_max") << " " << histogram_snapshot.max << "\n";
+            for (const char * q : {"0.5", "0.9", "0.99", "0.999"}){
+                text << labeled(entry.first, "quantile", q) << " " << histogram_snapshot.quantile(std::stod(q)) << "\n";
+            }
+        }
+        return text.str();
+    }
+
+
+    void Exporter::writeFile(){
+        std::ofstream metrics_file(file_path, std::ios::app);
+        if (!metrics_file){
+            std::cerr << "Error: could not open metrics file " << file_path << "\n";
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        while (true){
+            std::this_thread::sleep_for(period);
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            metrics_file << "# time_ms " << elapsed.count() << "\n" << snapshot() << "\n";
+            metrics_file.flush();
+        }
+    }
+
+
+    void Exporter::serveSocket(){
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)){
+            std::cerr << "Error: metrics socket path too long " << socket_path << "\n";
+            return;
+        }
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        // a socket left by a previous run
+        unlink(socket_path.c_str());
+        if (server < 0 || bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0
+            || listen(server, 4) < 0){
+            std::cerr << "Error: could not open metrics socket " << socket_path << ": " << strerror(errno) << "\n";
+            return;
+        }
+        while (true){
+            int client = accept(server, NULL, NULL);
+            if (client < 0){
+                continue;
+            }
+            std::string text = snapshot();
+            std::size_t written = 0;
+            while (written < text.size()){
+                // a scraper that disconnects early must not kill the process with SIGPIPE
+                ssize_t result = send(client, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+                if (result <= 0){
+                    break;
+                }
+                written += static_cast<std::size_t>(result);
+            }
+            close(client);
+        }
+    }
+
+
+    void Exporter::start(std::size_t process_id){
+        replaceId(file_path, process_id);
+        replaceId(socket_path, process_id);
+        if (!file_path.empty()){
+            threads.push_back(new std::thread([this] {this -> writeFile();}));
+        }
+        if (!socket_path.empty()){
+            threads.push_back(new std::thread([this] {this -> serveSocket();}));
+        }
+        DEBUG_MSG("METRICS file: " << file_path << " socket: " << socket_path);
+    }
+}
@@ -1,4 +1,5 @@
 #include "outbox.hpp"
+#include <algorithm>
 
 
 /* adds packet to outbox, if it is full
@@ -6,35 +7,61 @@
 */
 void OutBox::addPacket(Packet_ProcId const pack_and_dest){
     std::unique_lock<std::mutex> lock(mutex); //creates lock and calls mutex.lock()
-    while (curr_size == max_size){
-        //Atomically unlocks lock, blocks the current executing thread, 
+    std::size_t dest_id = pack_and_dest.dest_proc_id;
+    // packets for suspected processes never wait for space
+    while (curr_size >= max_size && !getDestination(dest_id).suspected){
+        //Atomically unlocks lock, blocks the current executing thread,
         //and adds it to the list of threads waiting on *this
         //The thread will be unblocked when notify_all() or notify_one() is executed.
         //It may also be unblocked spuriously
         cv_add.wait(lock);
     }
+    std::size_t source_id = pack_and_dest.packet -> source_id;
+    std::size_t seq_num = pack_and_dest.packet -> packet_seq_num;
+    DestinationQueue & dest = getDestination(dest_id);
+    dest.packets[source_id][seq_num] = OutBoxEntry(pack_and_dest);
+    dest.num_packets++;
+    TRACE_EVENT(OUTBOX_INSERT, source_id, seq_num, dest_id);
+    if (pack_and_dest.link_seq_num != 0){
+        dest.link_index[source_id][pack_and_dest.link_seq_num] = seq_num;
+    }
+    if (dest.suspected){
+        // sent by the next probe or when the destination is restored
+        return;
+    }
     curr_size += 1;
-    std::size_t dest_id = pack_and_dest.dest_proc_id;
-    std::size_t source_id = pack_and_dest.packet.source_id;
-    std::size_t seq_num = pack_and_dest.packet.packet_seq_num;
-    packets[dest_id][source_id][seq_num] = pack_and_dest.packet; 
+    dest.fresh.push_back(PacketKey(source_id, seq_num));
+    activate(dest_id, dest.urgent, urgent_active);
+    cv_send.notify_all();
 
     //destructor of lock releases the mutex
 }
 
 
+void OutBox::addAck(Packet_ProcId const ack_and_dest){
+    std::unique_lock<std::mutex> lock(mutex);
+    DestinationQueue & dest = getDestination(ack_and_dest.dest_proc_id);
+    dest.acks.push_back(ack_and_dest);
+    activate(ack_and_dest.dest_proc_id, dest.urgent, urgent_active);
+    cv_send.notify_all();
+}
+
+
 // returns true if successfully removed packet, false if there was not
 // the specified packet, waits only to own the lock of the outbox
 bool OutBox::removePacket(unsigned long int dest_proc_id, unsigned long int source_id, unsigned long int seq_num){
     std::unique_lock<std::mutex> lock(mutex);
     // check if packet is in the container
-    if(//(packets.count(dest_proc_id) == 1) && 
-        //(packets[dest_proc_id].count(source_id) == 1) && 
-        (packets[dest_proc_id][source_id].count(seq_num) == 1) ) {
-        
-        size_t num_removed = packets[dest_proc_id][source_id].erase(seq_num);
+    DestinationQueue & dest = getDestination(dest_proc_id);
+    if(dest.packets[source_id].count(seq_num) == 1){
+
+        size_t num_removed = dest.packets[source_id].erase(seq_num);
         assert((num_removed == 1) == true);
-        curr_size--;
+        dest.num_packets--;
+        if (!dest.suspected){
+            curr_size--;
+        }
+        TRACE_EVENT(OUTBOX_REMOVE, source_id, seq_num, dest_proc_id);
 
         cv_add.notify_all();
         return true;
@@ -45,40 +72,431 @@ bool OutBox::removePacket(unsigned long int dest_proc_id, unsigned long int sour
 }
 
 
+std::size_t OutBox::removeUpTo(std::size_t dest_proc_id, std::size_t source_id, std::size_t link_seq_num){
+    std::unique_lock<std::mutex> lock(mutex);
+    DestinationQueue & dest = getDestination(dest_proc_id);
+    std::map<std::size_t, std::size_t> & index = dest.link_index[source_id];
+    std::size_t num_removed = 0;
+    auto it_link = index.begin();
+    while (it_link != index.end() && it_link -> first <= link_seq_num){
+        num_removed += dest.packets[source_id].erase(it_link -> second);
+        it_link = index.erase(it_link);
+    }
+    dest.num_packets -= num_removed;
+    if (!dest.suspected){
+        curr_size -= num_removed;
+    }
+    if (num_removed > 0){
+        cv_add.notify_all();
+    }
+    return num_removed;
+}
 
-void OutBox::sendPackets(UDPSocket * udp_socket){
+
+bool OutBox::retransmitLink(std::size_t dest_proc_id, std::size_t source_id, std::size_t link_seq_num){
     std::unique_lock<std::mutex> lock(mutex);
-    // iterate destination process ids
-    for (auto it_dest_proc_id = packets.begin(); it_dest_proc_id != packets.end(); ++it_dest_proc_id){
-        SourceId_2_SeqNum_2_Packet source2seq2pack = it_dest_proc_id -> second;
-        std::size_t dest_id = it_dest_proc_id -> first;
-        sockaddr_in dest_addr = (*host_addresses)[dest_id];
-        // iterate source id
-        for (auto it_source_id = source2seq2pack.begin(); it_source_id != source2seq2pack.end(); ++ it_source_id){
-            std::map<std::size_t, Packet> seq2pack = it_source_id -> second;
-            // iterate sequence number
-            for (auto it_seq = seq2pack.begin(); it_seq != seq2pack.end(); ++it_seq){
-                udp_socket -> send(it_seq -> second, reinterpret_cast<sockaddr*> (&dest_addr));
+    DestinationQueue & dest = getDestination(dest_proc_id);
+    std::map<std::size_t, std::size_t> & index = dest.link_index[source_id];
+    auto it_link = index.find(link_seq_num);
+    if (it_link == index.end() || dest.suspected){
+        return false;
+    }
+    if (!dest.packets[source_id][it_link -> second].sent){
+        // the first transmission is still waiting in fresh
+        return true;
+    }
+    dest.retransmit.push_back(PacketKey(source_id, it_link -> second));
+    activate(dest_proc_id, dest.retransmission, retransmit_active);
+    cv_send.notify_all();
+    return true;
+}
+
+
+void OutBox::activate(std::size_t dest_id, SchedulingClass & sched, std::deque<std::size_t> & active){
+    if (!sched.active){
+        sched.active = true;
+        active.push_back(dest_id);
+    }
+}
+
+
+DestinationQueue & OutBox::getDestination(std::size_t dest_id){
+    auto it_dest = destinations.find(dest_id);
+    if (it_dest != destinations.end()){
+        return it_dest -> second;
+    }
+    DestinationQueue & dest = destinations[dest_id];
+    double rate = settings::getDouble("PACING_PEER_RATE_" + std::to_string(dest_id), pacing.peer_rate);
+    dest.bucket = TokenBucket(rate, std::max(pacing.peer_burst, static_cast<double>(MAX_LENGTH)));
+    dest.metrics = PeerLinkMetrics(dest_id);
+    return dest;
+}
+
+
+void OutBox::sweep(std::chrono::steady_clock::time_point now){
+    for (auto it_dest = destinations.begin(); it_dest != destinations.end(); ++it_dest){
+        std::size_t dest_id = it_dest -> first;
+        DestinationQueue & dest = it_dest -> second;
+        // packets not sent since the last sweep are scheduled again below
+        dest.retransmit.clear();
+
+        if (dest.suspected){
+            // probe with a single packet
+            if (dest.num_packets > 0 && failure_detector -> probeDue(dest_id, now)){
+                for (auto it_source = dest.packets.begin(); it_source != dest.packets.end(); ++it_source){
+                    if (!it_source -> second.empty()){
+                        dest.retransmit.push_back(PacketKey(it_source -> first, it_source -> second.begin() -> first));
+                        activate(dest_id, dest.retransmission, retransmit_active);
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // packets still waiting for their retransmission are scheduled again, but count as one timeout
+        std::size_t num_timed_out = 0;
+        for (auto it_source = dest.packets.begin(); it_source != dest.packets.end(); ++it_source){
+            for (auto it_seq = it_source -> second.begin(); it_seq != it_source -> second.end(); ++it_seq){
+                OutBoxEntry & entry = it_seq -> second;
+                // packets never sent are already in fresh
+                if (entry.sent && now - entry.last_sent >= retransmit_timeout){
+                    dest.retransmit.push_back(PacketKey(it_source -> first, it_seq -> first));
+                    if (!entry.timed_out){
+                        entry.timed_out = true;
+                        num_timed_out++;
+                    }
+                }
+            }
+        }
+
+        if (!dest.retransmit.empty() && failure_detector != NULL &&
+                failure_detector -> checkSilence(dest_id, now)){
+            suspect(dest);
+            continue;
+        }
+
+        dest.timed_out_since_tune += num_timed_out;
+        if (!dest.retransmit.empty()){
+            activate(dest_id, dest.retransmission, retransmit_active);
+        }
+        if (pacing.autotune){
+            tunePacing(dest, now);
+        }
+    }
+}
+
+
+void OutBox::suspect(DestinationQueue & dest){
+    dest.suspected = true;
+    dest.retransmit.clear();
+    dest.fresh.clear();
+    curr_size -= dest.num_packets;
+    cv_add.notify_all();
+}
+
+
+void OutBox::restore(std::size_t dest_id){
+    std::unique_lock<std::mutex> lock(mutex);
+    DestinationQueue & dest = getDestination(dest_id);
+    if (!dest.suspected){
+        return;
+    }
+    dest.suspected = false;
+    curr_size += dest.num_packets;
+    dest.retransmit.clear();
+    dest.fresh.clear();
+    for (auto it_source = dest.packets.begin(); it_source != dest.packets.end(); ++it_source){
+        for (auto it_seq = it_source -> second.begin(); it_seq != it_source -> second.end(); ++it_seq){
+            PacketKey key = PacketKey(it_source -> first, it_seq -> first);
+            if (it_seq -> second.sent){
+                dest.retransmit.push_back(key);
+            }
+            else{
+                dest.fresh.push_back(key);
+            }
+        }
+    }
+    if (!dest.retransmit.empty()){
+        activate(dest_id, dest.retransmission, retransmit_active);
+    }
+    if (!dest.fresh.empty()){
+        activate(dest_id, dest.urgent, urgent_active);
+    }
+    cv_send.notify_all();
+}
+
+
+void OutBox::tunePacing(DestinationQueue & dest, std::chrono::steady_clock::time_point now){
+    if (dest.bucket.isUnlimited() || dest.sent_since_tune == 0){
+        return;
+    }
+    double rate = dest.bucket.getRate();
+    double loss = static_cast<double>(dest.timed_out_since_tune) / static_cast<double>(dest.sent_since_tune);
+    if (loss > pacing.loss_threshold){
+        rate = std::max(pacing.min_rate, rate * pacing.decrease_factor);
+    }
+    else if (dest.timed_out_since_tune == 0){
+        rate = std::min(pacing.max_rate, rate + pacing.max_rate / 32);
+    }
+    dest.bucket.setRate(rate, now);
+    dest.sent_since_tune = 0;
+    dest.timed_out_since_tune = 0;
+}
+
+
+bool OutBox::sweepIfDue(){
+    std::unique_lock<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_sweep){
+        return false;
+    }
+    next_sweep = now + sweep_period;
+    sweep(now);
+    return true;
+}
+
+
+bool OutBox::admit(DestinationQueue & dest, const Packet_ProcId & datagram, std::chrono::steady_clock::time_point now){
+    // acks are small and delaying them causes retransmissions, they are never paced
+    if (!datagram.packet -> isData()){
+        return true;
+    }
+    std::size_t length = datagram.getLength();
+    if (!dest.bucket.tryConsume(length, now)){
+        dest.stats.paced++;
+        pacing_resume = std::min(pacing_resume, dest.bucket.availableAt(length, now));
+        return false;
+    }
+    if (!global_bucket.tryConsume(length, now)){
+        // give back the tokens of the destination, the datagram is not sent
+        dest.bucket.refund(length);
+        dest.stats.paced++;
+        pacing_resume = std::min(pacing_resume, global_bucket.availableAt(length, now));
+        return false;
+    }
+    return true;
+}
+
+
+const Packet_ProcId * OutBox::headDatagram(DestinationQueue & dest, bool urgent){
+    if (urgent && !dest.acks.empty()){
+        return &dest.acks.front();
+    }
+    std::deque<PacketKey> & keys = urgent ? dest.fresh : dest.retransmit;
+    while (!keys.empty()){
+        PacketKey key = keys.front();
+        auto it_source = dest.packets.find(key.first);
+        if (it_source != dest.packets.end()){
+            auto it_seq = it_source -> second.find(key.second);
+            if (it_seq != it_source -> second.end()){
+                return &(it_seq -> second.packet);
+            }
+        }
+        // packet was acked in the meantime
+        keys.pop_front();
+    }
+    return NULL;
+}
+
+
+void OutBox::popDatagram(DestinationQueue & dest, bool urgent){
+    if (urgent && !dest.acks.empty()){
+        dest.stats.acks_sent++;
+        dest.acks.pop_front();
+        return;
+    }
+    std::deque<PacketKey> & keys = urgent ? dest.fresh : dest.retransmit;
+    PacketKey key = keys.front();
+    OutBoxEntry & entry = dest.packets[key.first][key.second];
+    entry.sent = true;
+    entry.timed_out = false;
+    entry.last_sent = std::chrono::steady_clock::now();
+    if (urgent){
+        dest.stats.first_sent++;
+        dest.metrics.sent -> add();
+    }
+    else if (dest.suspected){
+        dest.stats.probes++;
+        dest.metrics.retransmitted -> add();
+    }
+    else{
+        dest.stats.retransmitted++;
+        dest.metrics.retransmitted -> add();
+    }
+    keys.pop_front();
+}
+
+
+/* deficit round robin: every time a destination reaches the head of active it gets
+   quantum bytes of credit, and sends datagrams as long as the credit covers them.
+   A destination whose queue becomes empty leaves the round and loses its credit,
+   a destination without tokens goes to the back of the round keeping its credit
+*/
+void OutBox::serve(std::deque<std::size_t> & active, bool urgent, std::vector<ScheduledDatagram> & batch){
+    auto now = std::chrono::steady_clock::now();
+    // number of consecutive destinations skipped for lack of tokens
+    std::size_t num_paced = 0;
+    while (!active.empty() && batch.size() < batch_size && num_paced < active.size()){
+        std::size_t dest_id = active.front();
+        DestinationQueue & dest = destinations[dest_id];
+        SchedulingClass & sched = urgent ? dest.urgent : dest.retransmission;
+        if (!sched.in_turn){
+            sched.in_turn = true;
+            sched.deficit += quantum;
+            dest.stats.turns++;
+        }
+
+        bool paced = false;
+        const Packet_ProcId * head = headDatagram(dest, urgent);
+        while (head != NULL && head -> getLength() <= sched.deficit && batch.size() < batch_size){
+            if (!admit(dest, *head, now)){
+                paced = true;
+                break;
+            }
+            std::size_t length = head -> getLength();
+            sched.deficit -= length;
+            dest.stats.bytes_sent += length;
+            dest.metrics.bytes_sent -> add(length);
+            dest.sent_since_tune++;
+            batch.push_back(ScheduledDatagram(*head, urgent && head -> packet -> isData()));
+            popDatagram(dest, urgent);
+            head = headDatagram(dest, urgent);
+        }
+
+        if (head == NULL){
+            sched.deficit = 0;
+            sched.in_turn = false;
+            sched.active = false;
+            active.pop_front();
+            num_paced = 0;
+        }
+        else if (paced || head -> getLength() > sched.deficit){
+            // end of the turn, the remaining credit is kept for the next one
+            sched.in_turn = false;
+            active.pop_front();
+            active.push_back(dest_id);
+            num_paced = paced ? num_paced + 1 : 0;
+        }
+        // otherwise the batch is full and the turn goes on at the next call
+    }
+}
+
+
+void OutBox::sendPackets(UDPSocket * udp_socket){
+    std::vector<ScheduledDatagram> batch;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (urgent_active.empty() && retransmit_active.empty() && !fec_encoder.hasPartialGroups()){
+            if (cv_send.wait_until(lock, next_sweep) == std::cv_status::timeout){
+                return;
+            }
+        }
+        if (!urgent_active.empty() || !retransmit_active.empty()){
+            pacing_resume = std::chrono::steady_clock::time_point::max();
+            serve(urgent_active, true, batch);
+            serve(retransmit_active, false, batch);
+            if (batch.empty()){
+                // every destination with something to send is waiting for tokens
+                cv_send.wait_until(lock, std::min(pacing_resume, next_sweep));
+                return;
+            }
+        }
+    }
+
+    if (batch.empty()){
+        // nothing else to send: the parity of the last packets is sent without waiting for a full group
+        for (std::pair<std::size_t, std::string> & parity : fec_encoder.flush()){
+            sockaddr_in dest_addr = (*host_addresses)[parity.first];
+            udp_socket -> sendBytes(parity.second.data(), parity.second.size(), reinterpret_cast<sockaddr*> (&dest_addr));
+            datagrams_sent++;
+        }
+        return;
+    }
+
+    // datagrams for the same destination are grouped, keeping their order, to be sent in frames
+    std::stable_sort(batch.begin(), batch.end(), [](const ScheduledDatagram & a, const ScheduledDatagram & b){
+        return a.packet.dest_proc_id < b.packet.dest_proc_id;
+    });
+
+    // datagrams are sent without holding the lock, so that acks can be processed meanwhile
+    std::vector<std::string> parities;
+    // packets of the current frame protected by FEC, each in a different group of the destination:
+    // a frame carries at most fec_encoder.getInterleave() of them, so that its loss costs each group one packet
+    std::size_t fec_lane = 0;
+    for (std::size_t i = 0; i < batch.size(); i++){
+        ScheduledDatagram & datagram = batch[i];
+        std::size_t dest_id = datagram.packet.dest_proc_id;
+        std::size_t length = datagram.packet.getLength();
+        bool protect = datagram.first_transmission && fec_encoder.isEnabled();
+        if (!frame_writer.empty() &&
+                (!frames || !frame_writer.fits(length) || (protect && fec_lane == fec_encoder.getInterleave()))){
+            flushFrame(udp_socket, dest_id, parities);
+            fec_lane = 0;
+        }
+        char * bytes = frame_writer.append(length);
+        datagram.packet.toBytes(bytes);
+        TRACE_EVENT(OUTBOX_SEND, datagram.packet.packet -> source_id, datagram.packet.packet -> packet_seq_num, dest_id);
+
+        if (protect){
+            fec::PacketId id(datagram.packet.packet -> source_id, datagram.packet.packet -> packet_seq_num);
+            for (std::string & parity : fec_encoder.add(dest_id, fec_lane, id, bytes, length)){
+                parities.push_back(parity);
             }
+            fec_lane++;
         }
+        if (i + 1 == batch.size() || batch[i + 1].packet.dest_proc_id != dest_id){
+            flushFrame(udp_socket, dest_id, parities);
+            fec_lane = 0;
+        }
+    }
+}
+
+
+void OutBox::flushFrame(UDPSocket * udp_socket, std::size_t dest_id, std::vector<std::string> & parities){
+    sockaddr_in dest_addr = (*host_addresses)[dest_id];
+    udp_socket -> sendBytes(frame_writer.data(), frame_writer.size(), reinterpret_cast<sockaddr*> (&dest_addr));
+    datagrams_sent++;
+    packets_sent += frame_writer.getNumPackets();
+    frame_writer.clear();
+    // parity is sent after the data packets it protects, so that they are not rebuilt needlessly
+    for (std::string & parity : parities){
+        udp_socket -> sendBytes(parity.data(), parity.size(), reinterpret_cast<sockaddr*> (&dest_addr));
+        datagrams_sent++;
+    }
+    parities.clear();
+}
+
+
+std::map<std::size_t, PeerServiceStats> OutBox::getServiceStats(){
+    std::unique_lock<std::mutex> lock(mutex);
+    std::map<std::size_t, PeerServiceStats> stats;
+    for (auto it_dest = destinations.begin(); it_dest != destinations.end(); ++it_dest){
+        stats[it_dest -> first] = it_dest -> second.stats;
+        stats[it_dest -> first].pacing_rate = it_dest -> second.bucket.getRate();
     }
+    return stats;
 }
 
 
 void OutBox::debug(){
     std::unique_lock<std::mutex> lock(mutex);
     // iterate destination process ids
-    for (auto it_dest_proc_id = packets.begin(); it_dest_proc_id != packets.end(); ++it_dest_proc_id){
-        SourceId_2_SeqNum_2_Packet source2seq2pack = it_dest_proc_id -> second;
-        std::size_t dest_id = it_dest_proc_id -> first;
-        sockaddr_in dest_addr = (*host_addresses)[dest_id];
+    for (auto it_dest = destinations.begin(); it_dest != destinations.end(); ++it_dest){
+        std::size_t dest_id = it_dest -> first;
+        DestinationQueue & dest = it_dest -> second;
         // iterate source id
-        for (auto it_source_id = source2seq2pack.begin(); it_source_id != source2seq2pack.end(); ++ it_source_id){
-            std::map<std::size_t, Packet> seq2pack = it_source_id -> second;
+        for (auto it_source_id = dest.packets.begin(); it_source_id != dest.packets.end(); ++ it_source_id){
             // iterate sequence number
-            for (auto it_seq = seq2pack.begin(); it_seq != seq2pack.end(); ++it_seq){
+            for (auto it_seq = it_source_id -> second.begin(); it_seq != it_source_id -> second.end(); ++it_seq){
                 std::cout << "dest: " << dest_id << " source: " << it_source_id->first << " seq_num: " << it_seq->first << "\n";
             }
         }
+        PeerServiceStats & stats = dest.stats;
+        std::cout << "dest: " << dest_id << " acks sent: " << stats.acks_sent << " first sent: " << stats.first_sent
+                  << " retransmitted: " << stats.retransmitted << " bytes sent: " << stats.bytes_sent
+                  << " turns: " << stats.turns << " paced: " << stats.paced
+                  << " suspected: " << dest.suspected << " probes: " << stats.probes
+                  << " pacing rate: " << dest.bucket.getRate() << "\n";
     }
 }
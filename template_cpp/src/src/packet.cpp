@@ -5,15 +5,16 @@
 using namespace packet;
 
 
-void Packet::toBytes(char * buffer){
+void Packet::toBytes(char * buffer, std::size_t i_link_seq_num) const{
     char* cur_pointer = &buffer[0];
 
     // encode header
     std::string source_id_str = std::to_string(source_id);
     std::string process_id_str = std::to_string(process_id);
     std::string packet_seq_num_str = std::to_string(packet_seq_num);
+    std::string link_seq_num_str = std::to_string(i_link_seq_num);
     std::string first_msg_seq_num_str = std::to_string(first_msg_seq_num);
-    std::string is_ack_str = std::to_string(static_cast<unsigned int>(is_ack));
+    std::string type_str = std::to_string(static_cast<unsigned int>(type));
     std::string payload_length_str = std::to_string(payload_length);
     std::string num_processes_str = std::to_string(num_processes);
 
@@ -27,12 +28,15 @@ void Packet::toBytes(char * buffer){
     memcpy(cur_pointer, packet_seq_num_str.c_str(), packet_seq_num_str.size() + 1);
     cur_pointer += packet_seq_num_str.size() + 1;
 
+    memcpy(cur_pointer, link_seq_num_str.c_str(), link_seq_num_str.size() + 1);
+    cur_pointer += link_seq_num_str.size() + 1;
+
     memcpy(cur_pointer, first_msg_seq_num_str.c_str(), first_msg_seq_num_str.size() + 1);
     cur_pointer += first_msg_seq_num_str.size() + 1;
 
-    memcpy(cur_pointer, is_ack_str.c_str(), is_ack_str.size() + 1);
-    assert((is_ack_str.size() == 1) == true);
-    cur_pointer += is_ack_str.size() + 1;
+    memcpy(cur_pointer, type_str.c_str(), type_str.size() + 1);
+    assert((type_str.size() == 1) == true);
+    cur_pointer += type_str.size() + 1;
 
     memcpy(cur_pointer, payload_length_str.c_str(), payload_length_str.size() + 1);
     cur_pointer += payload_length_str.size() + 1;
@@ -45,7 +49,7 @@ void Packet::toBytes(char * buffer){
     cur_pointer += written_bytes;
 
     // write all the messages (string that terminates with \0)
-    for (Message message : messages){
+    for (const Message & message : messages){
         int message_length = message.get_length();
         message.toBytes(cur_pointer);
         cur_pointer += message_length;
@@ -74,8 +78,9 @@ Packet Packet::decodeData(char * data){
     std::string source_id_str;
     std::string process_id_str;
     std::string packet_seq_num_str;
+    std::string link_seq_num_str;
     std::string first_msg_seq_num_str;
-    std::string is_ack_str;
+    std::string type_str;
     std::string payload_length_str;
     std::string num_processes_str;
 
@@ -91,12 +96,16 @@ Packet Packet::decodeData(char * data){
     assert((i > 1) == true);
     cur_pointer += i;
 
+    i = copyString(cur_pointer, &link_seq_num_str);
+    assert((i > 1) == true);
+    cur_pointer += i;
+
     i = copyString(cur_pointer, &first_msg_seq_num_str);
     assert((i > 1) == true);
     cur_pointer += i;
 
-    i = copyString(cur_pointer, &is_ack_str);
-    assert ((i == 2) == true);  //check boolean is only 1 value
+    i = copyString(cur_pointer, &type_str);
+    assert ((i == 2) == true);  //check type is only 1 digit
     cur_pointer += i;
 
     i = copyString(cur_pointer, &payload_length_str);
@@ -107,15 +116,16 @@ Packet Packet::decodeData(char * data){
     assert((i >= 2) == true);
     cur_pointer += i;
 
-     //DEBUG_MSG("meaning of numbers: source_id, process_id, packet_seq_num, first_msg_seq_num, is_ack, payload_length");
-     //DEBUG_MSG("PERFECT_LINK READING " << source_id_str << " " << process_id_str << " " << packet_seq_num_str << " " << first_msg_seq_num_str << " " << is_ack_str << " " << payload_length_str << "\n");
+     //DEBUG_MSG("meaning of numbers: source_id, process_id, packet_seq_num, link_seq_num, first_msg_seq_num, type, payload_length");
+     //DEBUG_MSG("PERFECT_LINK READING " << source_id_str << " " << process_id_str << " " << packet_seq_num_str << " " << first_msg_seq_num_str << " " << type_str << " " << payload_length_str << "\n");
 
     std::size_t i_source_id = std::stoul(source_id_str);
     std::size_t i_process_id = std::stoul(process_id_str);
     std::size_t i_packet_seq_num = std::stoul(packet_seq_num_str);
+    std::size_t i_link_seq_num = std::stoul(link_seq_num_str);
 
     std::size_t i_first_msg_seq_num = std::stoul(first_msg_seq_num_str);
-    bool is_ack = static_cast<bool>(std::stoi(is_ack_str));
+    PacketType i_type = static_cast<PacketType>(std::stoi(type_str));
     std:size_t i_num_processes = std::stoul(num_processes_str);
 
     // decode Vector Clocks
@@ -133,15 +143,20 @@ Packet Packet::decodeData(char * data){
 
 
     
-    if (is_ack){
+    if (i_type == ACK){
         return createAck(i_process_id, i_source_id,  i_packet_seq_num, i_num_processes, i_vector_clock);
     }
+    else if (i_type == CUMULATIVE_ACK){
+        return createCumulativeAck(i_process_id, i_source_id, i_link_seq_num);
+    }
     else{
        // DEBUG_MSG("About to decode payload length");
         std::size_t payload_length = std::stoul(payload_length_str);
         //DEBUG_MSG("Successfully decoded payload length");
         // parse messages
         Packet p = Packet(i_process_id, i_source_id, i_packet_seq_num, i_num_processes, i_vector_clock); 
+        p.type = i_type;
+        p.link_seq_num = i_link_seq_num;
         while (p.payload_length < payload_length){
             //DEBUG_MSG("About to decode message number " << p.getNumMessages() << ".Current packet length: " << p.getLength());
             Message cur_message = Message::decodeData(cur_pointer); //retrieve current message
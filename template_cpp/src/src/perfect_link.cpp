@@ -11,6 +11,24 @@ PerfectLink::PerfectLink(unsigned long int i_process_id, std::map<std::size_t, s
     process_id(i_process_id), udp_socket(port_num, -1), host_addresses(i_host_addresses), outbox(NULL)
 {
     outbox.host_addresses = i_host_addresses;
+    outbox.failure_detector = &failure_detector;
+    nack_mode = settings::getString("LINK_MODE", "ack") == "nack";
+    DEBUG_MSG("PERFECT-LINK nack mode: " << nack_mode);
+    // FEC groups of k data packets protected by m parity datagrams, disabled if k is 0,
+    // interleaved across the frames sent to a destination
+    outbox.fec_encoder = fec::Encoder(process_id, settings::getSize("FEC_K", 0), settings::getSize("FEC_M", 1),
+                                      settings::getSize("FEC_INTERLEAVE", 8));
+
+    // packets to this process do not go through the link
+    for (auto & host : *host_addresses){
+        if (host.first != process_id){
+            peer_metrics.emplace(host.first, PeerLinkMetrics(host.first));
+        }
+    }
+    metrics::gauge(metrics::labeled("queue_depth", "queue", "pl_received"), [this] {return received_packets.getSize();});
+    metrics::gauge(metrics::labeled("queue_depth", "queue", "pl_packets_to_send"), [this] {return packets_to_send.getSize();});
+    metrics::gauge(metrics::labeled("queue_depth", "queue", "pl_acks_to_send"), [this] {return acks_to_send.getSize();});
+    metrics::gauge("pl_outbox_occupancy", [this] {return outbox.getOccupancy();});
 }
 
 
@@ -18,40 +36,215 @@ inline void PerfectLink::deliver(Packet p){
     beb -> deliver(p);
 }
 
+
+void PerfectLink::send(Packet_ProcId packet_dest){
+    if (packet_dest.dest_proc_id == process_id){
+        deliver(*packet_dest.packet);
+        return;
+    }
+    packets_to_send.push(packet_dest);
+}
+
 void PerfectLink::listen(){
     while(true){
-        Packet received = udp_socket.receivePacket();
-        received_packets.push(received);
+        std::size_t length = udp_socket.receiveBytes(buffer_received, MAX_DATAGRAM_LENGTH);
+        TRACE_EVENT(RECEIVE, 0, length);
+        if (fec::isParity(buffer_received, length)){
+            for (Packet & rebuilt : fec_decoder.onParity(buffer_received, length)){
+                DEBUG_MSG("PERFECT-LINK rebuilt packet from FEC parity: source: " << rebuilt.source_id << " sender: " << rebuilt.process_id << " seq_num: " << rebuilt.packet_seq_num);
+                received_packets.push(rebuilt);
+            }
+            continue;
+        }
+        if (frame::isFrame(buffer_received, length)){
+            for (std::pair<char *, std::size_t> & framed : frame::split(buffer_received, length)){
+                receivePacket(framed.first, framed.second);
+            }
+            continue;
+        }
+        receivePacket(buffer_received, length);
+    }
+}
+
+
+void PerfectLink::receivePacket(char * bytes, std::size_t length){
+    Packet received = Packet::decodeData(bytes);
+    TRACE_EVENT(DECODE, received.source_id, received.packet_seq_num, received.process_id);
+    if (received.isData()){
+        fec_decoder.onData(received.process_id, fec::PacketId(received.source_id, received.packet_seq_num), bytes, length);
     }
+    received_packets.push(received);
 }
 
 /* 1) If queue of arrived packets is non empty, take out first packet
     if the packet received was a normal message:
         2-a) populates acks_queue with the ack to be sent to the sender process
+             (in nack mode, tracks the link stream of the packet and sends nacks for missing packets)
         3-a) delivers the packet on the head of the queue if it was not already delivered
     if the packet received was an ack:
-        2-b) remove corresponding packet from outbox
+        2-b) remove corresponding packet(s) from outbox
+    if the packet received was a nack:
+        2-c) schedule the missing packets for retransmission
 */
 void PerfectLink::processArrivedMessages(){
     while(true){
         Packet received = received_packets.pop();
-        if (received.is_ack){
-            DEBUG_MSG("PERFECT-LINK received ACK: source: " <<  received.source_id << " sender: " << received.process_id << " seq_num: "  << received.packet_seq_num);
-            bool remove_success = outbox.removePacket(received.process_id, received.source_id, received.packet_seq_num);
-            DEBUG_MSG("PERFECT-LINK removed packet from outbox: " << remove_success);
+        if (watermark_changed.load(std::memory_order_relaxed)){
+            applyWatermark();
+        }
+        if (failure_detector.heardFrom(received.process_id)){
+            outbox.restore(received.process_id);
+        }
+        switch (received.type){
+            case ACK: {
+                TRACE_EVENT(ACK, received.source_id, received.packet_seq_num, received.process_id);
+                DEBUG_MSG("PERFECT-LINK received ACK: source: " <<  received.source_id << " sender: " << received.process_id << " seq_num: "  << received.packet_seq_num);
+                bool remove_success = outbox.removePacket(received.process_id, received.source_id, received.packet_seq_num);
+                if (remove_success){
+                    peer_metrics[received.process_id].acked -> add();
+                }
+                DEBUG_MSG("PERFECT-LINK removed packet from outbox: " << remove_success);
+                break;
+            }
+            case CUMULATIVE_ACK: {
+                std::size_t num_removed = outbox.removeUpTo(received.process_id, received.source_id, received.link_seq_num);
+                peer_metrics[received.process_id].acked -> add(num_removed);
+                DEBUG_MSG("PERFECT-LINK received CUMULATIVE ACK: source: " <<  received.source_id << " sender: " << received.process_id << " link_seq_num: "  << received.link_seq_num << " removed: " << num_removed);
+                break;
+            }
+            case NACK: {
+                for (std::size_t i = 0; i < received.getNumMessages(); i++){
+                    std::size_t link_seq_num = std::stoul(received.getMessage(i).getContent());
+                    outbox.retransmitLink(received.process_id, received.source_id, link_seq_num);
+                }
+                DEBUG_MSG("PERFECT-LINK received NACK: source: " <<  received.source_id << " sender: " << received.process_id << " missing: "  << received.getNumMessages());
+                break;
+            }
+            case DATA: {
+                DEBUG_MSG("PERFECT-LINK received packet: source" <<  received.source_id << " sender: " << received.process_id << " seq_num: "  << received.packet_seq_num);
+                if (nack_mode){
+                    trackLinkStream(received);
+                }
+                else{
+                    Packet ack = Packet::createAck(process_id, received.source_id, received.packet_seq_num, received.num_processes, received.vector_clock);
+                    std::size_t dest_proc_id = received.process_id;
+                    Packet_ProcId ack_and_dest = Packet_ProcId(ack, dest_proc_id);
+                    acks_to_send.push(ack_and_dest);
+                }
+
+                PeerLinkMetrics & sender_metrics = peer_metrics[received.process_id];
+                sender_metrics.received -> add();
+                // deliver if not already delivered
+                if (delivered[received.process_id][received.source_id].count(received.packet_seq_num) == 0){
+                    delivered[received.process_id][received.source_id].insert(received.packet_seq_num);
+                    deliver(received);
+                }
+                else{
+                    sender_metrics.duplicated -> add();
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+
+void PerfectLink::applyWatermark(){
+    std::vector<std::size_t> cur_watermark;
+    {
+        std::unique_lock<std::mutex> lock(watermark_mutex);
+        cur_watermark = watermark;
+        watermark_changed.store(false);
+    }
+    for (auto it_sender = delivered.begin(); it_sender != delivered.end(); ++it_sender){
+        for (auto it_source = it_sender -> second.begin(); it_source != it_sender -> second.end(); ++it_source){
+            // control packets (source 0) are numbered by their sender, not by a source
+            std::size_t source_id = it_source -> first;
+            if (source_id != 0 && source_id <= cur_watermark.size()){
+                it_source -> second.advanceTo(cur_watermark[source_id - 1]);
+            }
+        }
+    }
+}
+
 
+void PerfectLink::trackLinkStream(Packet & received){
+    std::unique_lock<std::mutex> lock(streams_mutex);
+    std::size_t sender_id = received.process_id;
+    std::size_t source_id = received.source_id;
+    LinkStream & stream = streams[sender_id][source_id];
+    std::size_t link_seq_num = received.link_seq_num;
+
+    if (link_seq_num < stream.next_expected || stream.above.count(link_seq_num) == 1){
+        // retransmission: the sender probably did not receive the last cumulative ack
+        queueCumulativeAck(sender_id, source_id, stream);
+        return;
+    }
+
+    if (link_seq_num == stream.next_expected){
+        stream.next_expected++;
+        while (stream.above.count(stream.next_expected) == 1){
+            stream.above.erase(stream.next_expected);
+            stream.next_expected++;
         }
-        else{
-            DEBUG_MSG("PERFECT-LINK received packet: source" <<  received.source_id << " sender: " << received.process_id << " seq_num: "  << received.packet_seq_num);
-            Packet ack = Packet::createAck(process_id, received.source_id, received.packet_seq_num, received.num_processes, received.vector_clock);
-            std::size_t dest_proc_id = received.process_id;
-            Packet_ProcId ack_and_dest = Packet_ProcId(ack, dest_proc_id);
-            acks_to_send.push(ack_and_dest);
-
-            // deliver if not already delivered
-            if (delivered[received.process_id][received.source_id].count(received.packet_seq_num) == 0){
-                delivered[received.process_id][received.source_id].insert(received.packet_seq_num);
-                deliver(received);
+    }
+    else{
+        // packets between next_expected and link_seq_num are missing, the ones already nacked are
+        // recovered by the retransmission timeout of the sender if the nack or the repair is lost
+        std::vector<std::size_t> missing;
+        for (std::size_t i = std::max(stream.next_expected, stream.highest_nacked + 1); i < link_seq_num; i++){
+            if (stream.above.count(i) == 0){
+                missing.push_back(i);
+            }
+        }
+        stream.highest_nacked = std::max(stream.highest_nacked, link_seq_num - 1);
+        stream.above.insert(link_seq_num);
+        queueNacks(sender_id, source_id, missing);
+    }
+
+    stream.received_since_ack++;
+    if (stream.received_since_ack >= cumulative_ack_every){
+        queueCumulativeAck(sender_id, source_id, stream);
+    }
+}
+
+
+void PerfectLink::queueNacks(std::size_t sender_id, std::size_t source_id, std::vector<std::size_t> & missing){
+    std::vector<std::size_t> cur_missing;
+    Packet nack = Packet::createNack(process_id, source_id, cur_missing);
+    for (std::size_t link_seq_num : missing){
+        Message cur_message(std::to_string(link_seq_num));
+        if (!nack.canAddMessage(cur_message)){
+            acks_to_send.push(Packet_ProcId(nack, sender_id));
+            nack = Packet::createNack(process_id, source_id, cur_missing);
+        }
+        nack.addMessage(cur_message);
+    }
+    if (nack.getNumMessages() > 0){
+        acks_to_send.push(Packet_ProcId(nack, sender_id));
+    }
+}
+
+
+void PerfectLink::queueCumulativeAck(std::size_t sender_id, std::size_t source_id, LinkStream & stream){
+    if (stream.next_expected <= 1){
+        return;
+    }
+    stream.acked_up_to = stream.next_expected - 1;
+    stream.received_since_ack = 0;
+    acks_to_send.push(Packet_ProcId(Packet::createCumulativeAck(process_id, source_id, stream.acked_up_to), sender_id));
+}
+
+
+void PerfectLink::flushCumulativeAcks(){
+    std::unique_lock<std::mutex> lock(streams_mutex);
+    for (auto it_sender = streams.begin(); it_sender != streams.end(); ++it_sender){
+        for (auto it_source = it_sender -> second.begin(); it_source != it_sender -> second.end(); ++it_source){
+            LinkStream & stream = it_source -> second;
+            if (stream.next_expected - 1 > stream.acked_up_to){
+                queueCumulativeAck(it_sender -> first, it_source -> first, stream);
             }
         }
     }
@@ -62,30 +255,33 @@ void PerfectLink::processArrivedMessages(){
 void PerfectLink::sendAcks(){
     while (true){
         Packet_ProcId ack_dest = acks_to_send.pop();
-        sockaddr_in dest_addr = (*host_addresses)[ack_dest.dest_proc_id];
-        sender_lock.lock();
-        DEBUG_MSG("PERFECT-LINK sending ACK: dest: " << ack_dest.dest_proc_id << " source: " <<  ack_dest.packet.source_id << " sender: " << ack_dest.packet.process_id << " seq_num: "  << ack_dest.packet.packet_seq_num);
-        udp_socket.send(ack_dest.packet, reinterpret_cast<sockaddr*> (&dest_addr));
-        sender_lock.unlock();
+        DEBUG_MSG("PERFECT-LINK sending ACK: dest: " << ack_dest.dest_proc_id << " source: " <<  ack_dest.packet -> source_id << " sender: " << ack_dest.packet -> process_id << " seq_num: "  << ack_dest.packet -> packet_seq_num);
+        outbox.addAck(ack_dest);
     }
 }
 
 void PerfectLink::sendPackets(){
     while(true){
-        sender_lock.lock();
-        DEBUG_MSG("PERFECT-LINK sending packets from outbox");
-        if (debug_mode){
-            outbox.debug();
+        if (outbox.sweepIfDue()){
+            DEBUG_MSG("PERFECT-LINK retransmitting packets from outbox. FEC parity sent: " << getFecParitySent() << " rebuilt: " << getFecRecovered()
+                      << " packets per datagram: " << outbox.getPacketsPerDatagram());
+            if (nack_mode){
+                flushCumulativeAcks();
+            }
+            if (debug_mode){
+                outbox.debug();
+            }
         }
         outbox.sendPackets(&udp_socket);
-        sender_lock.unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(2 * 1000));
     }
 }
 
 void PerfectLink::addPacketsToOutBox(){
     while(true){
         Packet_ProcId cur_packet_dest = packets_to_send.pop();
+        if (nack_mode){
+            cur_packet_dest.link_seq_num = ++next_link_seq_num[cur_packet_dest.dest_proc_id][cur_packet_dest.packet -> source_id];
+        }
         outbox.addPacket(cur_packet_dest);
     }
 }
@@ -93,11 +289,11 @@ void PerfectLink::addPacketsToOutBox(){
 // when this function is called the current thread stops executing and waits for
 // the spawned threads to finish (which is when the whole program stops)
 void PerfectLink::start(){
-    std::thread * listener = new std::thread([this] {this -> listen();});
-    std::thread * ack_sender = new std::thread([this] {this -> sendAcks();});
-    std::thread * processor = new std::thread([this] {this -> processArrivedMessages();});
-    std::thread * packet_sender = new std::thread([this] {this -> sendPackets();});
-    std::thread * outbox_dealer = new std::thread([this] {this -> addPacketsToOutBox();});
+    std::thread * listener = new std::thread([this] {TRACE_THREAD("pl_listen"); this -> listen();});
+    std::thread * ack_sender = new std::thread([this] {TRACE_THREAD("pl_send_acks"); this -> sendAcks();});
+    std::thread * processor = new std::thread([this] {TRACE_THREAD("pl_process"); this -> processArrivedMessages();});
+    std::thread * packet_sender = new std::thread([this] {TRACE_THREAD("pl_send"); this -> sendPackets();});
+    std::thread * outbox_dealer = new std::thread([this] {TRACE_THREAD("pl_outbox"); this -> addPacketsToOutBox();});
     
     threads.push_back(listener);
     threads.push_back(ack_sender);
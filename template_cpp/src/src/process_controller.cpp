@@ -4,6 +4,14 @@
 ProcessController::ProcessController(std::size_t id, Parser parser): 
 hosts(parser.hosts()), process_id(id)
 {
+    // process sets, vector clocks and carried ids have room for MAX_PROCESSES processes
+    if (hosts.size() > MAX_PROCESSES){
+        std::cerr << "Error: " << hosts.size() << " hosts, at most " << MAX_PROCESSES << " processes are supported\n";
+        exit(EXIT_FAILURE);
+    }
+    // vector clocks are compared with the kernels specialized for the size of the system
+    clock_kernels::configure(hosts.size());
+
     //populate host_addresses
     for (Parser::Host host : parser.hosts()){
         sockaddr_in host_addr;
@@ -39,34 +47,24 @@ hosts(parser.hosts()), process_id(id)
     }
     config_file.close();
 
-    output_file.open(parser.outputPath());
-    if (output_file.bad()){
+    if (!log_writer.open(parser.outputPath())){
         std::cerr << "Error: could not open output file\n";
         exit(EXIT_FAILURE);
     }
+    trace::configure(parser.outputPath(), process_id);
 
 }
 
 
 
-void ProcessController::onPacketDelivered(packet::Packet p){
-    std::string out_content;
+void ProcessController::onPacketDelivered(const packet::Packet & p){
     // packet contains multiple messages
-    for (std::size_t i = p.first_msg_seq_num; i < p.first_msg_seq_num + p.getNumMessages(); i++){
-        out_content += "d " + std::to_string(p.source_id) + " " +  std::to_string(i) + "\n";
-    }
-    output_file << out_content;
-    DEBUG_MSG("Process Controller writing delivered");
+    log_writer.append('d', p.source_id, p.first_msg_seq_num, p.getNumMessages());
 }
 
 
- void ProcessController::onPacketBroadcast(packet::Packet p){
-    std::string out_content;
-    for (std::size_t i = p.first_msg_seq_num; i < p.first_msg_seq_num + p.getNumMessages(); i++){
-        out_content += "b " + std::to_string(i) + "\n";
-    }
-    DEBUG_MSG("Process Controller writing broadcast");
-    output_file << out_content;
+ void ProcessController::onPacketBroadcast(const packet::Packet & p){
+    log_writer.append('b', p.source_id, p.first_msg_seq_num, p.getNumMessages());
  }
 
 
@@ -83,6 +81,11 @@ void ProcessController::onPacketDelivered(packet::Packet p){
      urb -> setCausalBroadcast(causal_broadcast);
      causal_broadcast -> setUrb(urb);
 
+     metrics::gauge("log_backlog", [this]() noexcept {return log_writer.getBacklog();});
+     metrics::gauge("log_committed_bytes", [this]() noexcept {return log_writer.getCommitted();});
+
+     log_writer.start();
+     metrics_exporter.start(process_id);
      perfect_link -> start();
      beb -> start();
      urb -> start();
@@ -100,18 +103,30 @@ void ProcessController::onPacketDelivered(packet::Packet p){
      for (auto thread : causal_broadcast -> threads){
          thread->join();
      }
+     for (auto thread : log_writer.threads){
+         thread->join();
+     }
+     for (auto thread : metrics_exporter.threads){
+         thread->join();
+     }
  }
 
  
 void ProcessController::stopProcess(){
+    // the lines of the events logged so far are written by the log writer, the file is complete
+    // once stop returns (the process exits right after, that closes it)
+    log_writer.stop();
+    const char closed_output[] = "Closed output files\n";
+    ::write(STDOUT_FILENO, closed_output, sizeof(closed_output) - 1);
+
+    // trace events, if the trace points are compiled
+    trace::dump();
+
+    // last: the listener exits the process as soon as the socket is closed
     if (perfect_link != NULL){
         perfect_link->closeSocket();
-        std::cout << "Closed socket\n";
+        const char closed_socket[] = "Closed socket\n";
+        ::write(STDOUT_FILENO, closed_socket, sizeof(closed_socket) - 1);
     }
-    
-    output_file.flush();
-    output_file.close();
-    std::cout << "Closed output files\n";
-    std::cout.flush();
 
-} 
\ No newline at end of file
+}
\ No newline at end of file
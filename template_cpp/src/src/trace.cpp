@@ -0,0 +1,238 @@
+#include "trace.hpp"
+#include "settings.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace trace{
+
+    namespace{
+        const char * const POINT_NAMES[NUM_POINTS] = {
+            "broadcast", "outbox_insert", "outbox_send", "receive", "decode", "ack", "outbox_remove",
+            "beb_deliver", "urb_deliver", "causal_deliver", "output_write"};
+
+        /* events started ... recorded - 1 are in the ring (positions modulo capacity). The owner thread
+           increments started before writing an event and recorded after, a reader copying the event at
+           position i knows it was not overwritten meanwhile if started is at most i + capacity afterwards */
+        struct Ring{
+            std::atomic<uint64_t> started{0};
+            std::atomic<uint64_t> recorded{0};
+            char name[32] = {};
+            Event * events = NULL;
+        };
+
+        // set by configure, before the threads start
+        std::size_t capacity = 0;
+        std::string trace_path;
+        std::size_t trace_process_id = 0;
+
+        std::array<std::atomic<Ring *>, MAX_THREADS> rings = {};
+        std::atomic<std::size_t> num_rings{0};
+
+        // the ring of the calling thread, NULL if it is not traced
+        Ring * threadRing(){
+            thread_local Ring * ring = [] {
+                if (capacity == 0){
+                    return static_cast<Ring *>(NULL);
+                }
+                std::size_t index = num_rings.fetch_add(1);
+                if (index >= MAX_THREADS){
+                    return static_cast<Ring *>(NULL);
+                }
+                Ring * new_ring = new Ring();
+                new_ring -> events = new Event[capacity]();
+                rings[index].store(new_ring, std::memory_order_release);
+                return new_ring;
+            }();
+            return ring;
+        }
+
+        // output of dump, only calls that are async-signal-safe
+        class JsonWriter{
+            private:
+                int fd = -1;
+                char buffer[1 << 16];
+                std::size_t length = 0;
+
+            public:
+                void open(int i_fd){
+                    fd = i_fd;
+                    length = 0;
+                }
+
+                void flush(){
+                    std::size_t written = 0;
+                    while (written < length){
+                        ssize_t result = ::write(fd, buffer + written, length - written);
+                        if (result <= 0){
+                            break;
+                        }
+                        written += static_cast<std::size_t>(result);
+                    }
+                    length = 0;
+                }
+
+                // value is shorter than the buffer
+                void text(const char * value){
+                    std::size_t value_length = strlen(value);
+                    if (length + value_length > sizeof(buffer)){
+                        flush();
+                    }
+                    memcpy(buffer + length, value, value_length);
+                    length += value_length;
+                }
+
+                void number(uint64_t value){
+                    if (length + 20 > sizeof(buffer)){
+                        flush();
+                    }
+                    length = static_cast<std::size_t>(std::to_chars(buffer + length, buffer + sizeof(buffer), value).ptr - buffer);
+                }
+
+                // nanoseconds as microseconds with 3 decimals
+                void microseconds(uint64_t nanoseconds){
+                    number(nanoseconds / 1000);
+                    uint64_t fraction = nanoseconds % 1000;
+                    text(fraction < 10 ? ".00" : (fraction < 100 ? ".0" : "."));
+                    number(fraction);
+                }
+        };
+
+        // not on the stack: the signal handler runs on the stack of an arbitrary thread
+        JsonWriter dump_writer;
+
+        void writeThreadName(JsonWriter & writer, std::size_t index, const Ring & ring){
+            writer.text("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":");
+            writer.number(trace_process_id);
+            writer.text(",\"tid\":");
+            writer.number(index);
+            writer.text(",\"args\":{\"name\":\"");
+            if (ring.name[0] != '\0'){
+                writer.text(ring.name);
+            }
+            else{
+                writer.text("thread ");
+                writer.number(index);
+            }
+            writer.text("\"}}");
+        }
+
+        void writeEvent(JsonWriter & writer, std::size_t index, const Event & event){
+            writer.text(",\n{\"name\":\"");
+            writer.text(POINT_NAMES[event.point]);
+            writer.text(event.duration > 0 ? "\",\"ph\":\"X\",\"dur\":" : "\",\"ph\":\"i\",\"s\":\"t\"");
+            if (event.duration > 0){
+                writer.microseconds(event.duration);
+            }
+            writer.text(",\"ts\":");
+            writer.microseconds(event.timestamp);
+            writer.text(",\"pid\":");
+            writer.number(trace_process_id);
+            writer.text(",\"tid\":");
+            writer.number(index);
+            writer.text(",\"args\":{\"source\":");
+            writer.number(event.source);
+            writer.text(",\"seq\":");
+            writer.number(event.seq);
+            writer.text(",\"peer\":");
+            writer.number(event.peer);
+            writer.text("}}");
+        }
+    }
+
+
+    void configure(const std::string & output_path, std::size_t process_id){
+        std::size_t requested = settings::getSize("TRACE_RING", 1 << 16);
+        capacity = 64;
+        while (capacity < requested){
+            capacity *= 2;
+        }
+        trace_process_id = process_id;
+        trace_path = settings::getString("TRACE_FILE", output_path + ".trace.json");
+        std::size_t position = trace_path.find("{id}");
+        if (position != std::string::npos){
+            trace_path.replace(position, 4, std::to_string(process_id));
+        }
+    }
+
+
+    uint64_t now(){
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+
+    void record(Point point, std::size_t source, std::size_t seq, std::size_t peer, uint64_t start){
+        Ring * ring = threadRing();
+        if (ring == NULL){
+            return;
+        }
+        uint64_t position = ring -> recorded.load(std::memory_order_relaxed);
+        ring -> started.store(position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        Event & event = ring -> events[position & (capacity - 1)];
+        uint64_t timestamp = now();
+        event.timestamp = start == 0 ? timestamp : start;
+        event.duration = start == 0 ? 0 : static_cast<uint32_t>(timestamp - start);
+        event.point = point;
+        event.peer = static_cast<uint16_t>(peer);
+        event.source = static_cast<uint32_t>(source);
+        event.seq = seq;
+
+        ring -> recorded.store(position + 1, std::memory_order_release);
+    }
+
+
+    void nameThread(const char * name){
+        Ring * ring = threadRing();
+        if (ring != NULL){
+            strncpy(ring -> name, name, sizeof(ring -> name) - 1);
+        }
+    }
+
+
+    void dump(){
+        std::size_t cur_num_rings = std::min(num_rings.load(), MAX_THREADS);
+        if (cur_num_rings == 0){
+            return;
+        }
+        int fd = ::open(trace_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0){
+            return;
+        }
+        JsonWriter & writer = dump_writer;
+        writer.open(fd);
+        writer.text("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":");
+        writer.number(trace_process_id);
+        writer.text(",\"args\":{\"name\":\"process ");
+        writer.number(trace_process_id);
+        writer.text("\"}}");
+
+        for (std::size_t index = 0; index < cur_num_rings; index++){
+            Ring * ring = rings[index].load(std::memory_order_acquire);
+            if (ring == NULL){
+                continue;
+            }
+            writer.text(",\n");
+            writeThreadName(writer, index, *ring);
+            uint64_t end = ring -> recorded.load(std::memory_order_acquire);
+            for (uint64_t i = end > capacity ? end - capacity : 0; i < end; i++){
+                Event event = ring -> events[i & (capacity - 1)];
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (ring -> started.load(std::memory_order_relaxed) > i + capacity || event.point >= NUM_POINTS){
+                    // overwritten while it was copied
+                    continue;
+                }
+                writeEvent(writer, index, event);
+            }
+        }
+        writer.text("\n]}\n");
+        writer.flush();
+        ::close(fd);
+    }
+}
@@ -34,8 +34,22 @@ UDPSocket::UDPSocket(unsigned short port, int rcv_timeout=-1):timeout_sec(rcv_ti
 
 
 packet::Packet UDPSocket::receivePacket(){
+    receiveBytes(buffer_received, packet::MAX_DATAGRAM_LENGTH);
+    packet::Packet p = packet::Packet::decodeData(buffer_received);
+    return p;
+}
+
+
+
+void UDPSocket::send(packet::Packet p, const sockaddr * dest){
+    p.toBytes(buffer_send);
+    sendBytes(buffer_send, p.getLength(), dest);
+}
+
+
+std::size_t UDPSocket::receiveBytes(char * buffer, std::size_t max_length){
     ssize_t n;  // number of bytes received
-    n = TEMP_FAILURE_RETRY(recvfrom(sockfd, buffer_received, packet::MAX_LENGTH, MSG_WAITALL, NULL, 0));
+    n = TEMP_FAILURE_RETRY(recvfrom(sockfd, buffer, max_length, MSG_WAITALL, NULL, 0));
     if (n < 0){
         if (0 || errno == EAGAIN || errno == EWOULDBLOCK){
             throw TimeoutException("timeout on socket.recvfrom() has expired before receiving message\n");
@@ -45,15 +59,12 @@ packet::Packet UDPSocket::receivePacket(){
             exit(EXIT_FAILURE);
         }
     }
-    packet::Packet p = packet::Packet::decodeData(buffer_received);
-    return p;
+    return static_cast<std::size_t>(n);
 }
 
 
-
-void UDPSocket::send(packet::Packet p, const sockaddr * dest){
-    p.toBytes(buffer_send);
-    ssize_t n = sendto(sockfd, buffer_send, p.getLength(), MSG_CONFIRM, dest, sizeof(*dest));
+void UDPSocket::sendBytes(const char * buffer, std::size_t length, const sockaddr * dest){
+    ssize_t n = sendto(sockfd, buffer, length, MSG_CONFIRM, dest, sizeof(*dest));
     if (n < 0){
         std::cout << "Socket failed to send. Error number: " << errno << "\n";
         exit(EXIT_FAILURE);
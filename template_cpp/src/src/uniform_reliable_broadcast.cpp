@@ -1,8 +1,37 @@
 #include "uniform_reliable_broadcast.hpp"
+#include <sstream>
 
 
-bool UniformReliableBroadcast::canDeliver(std::size_t source_id, std::size_t seq_num){
-    return acks[source_id][seq_num].size() > num_processes / 2;
+UniformReliableBroadcast::UniformReliableBroadcast(std::size_t i_process_id, std::size_t i_num_processes):
+    process_id(i_process_id), num_processes(i_num_processes){
+    std::string relay = settings::getString("URB_RELAY", "full");
+    relay_mode = relay == "tree" ? TREE : (relay == "digest" ? DIGEST : FULL);
+
+    // children have higher ranks than their parent
+    subtree_sizes.assign(num_processes, 1);
+    for (std::size_t rank = num_processes - 1; rank > 0; rank--){
+        subtree_sizes[(rank - 1) / tree_fanout] += subtree_sizes[rank];
+    }
+
+    metrics::gauge(metrics::labeled("queue_depth", "queue", "urb_deliver"), [this] {return packets_to_deliver.getSize();});
+    metrics::gauge("urb_tracked_packets", [this] {return getNumTrackedPackets();});
+}
+
+
+bool UniformReliableBroadcast::canDeliver(URBShard & shard, std::size_t source_id, std::size_t seq_num){
+    return shard.acks[source_id][seq_num].size() > num_processes / 2;
+}
+
+
+std::size_t UniformReliableBroadcast::getNumTrackedPackets(){
+    std::size_t num_packets = 0;
+    for (URBShard & shard : shards){
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        for (auto it_source = shard.acks.begin(); it_source != shard.acks.end(); ++it_source){
+            num_packets += it_source -> second.size();
+        }
+    }
+    return num_packets;
 }
 
 
@@ -10,6 +39,8 @@ void UniformReliableBroadcast::URBDeliver(){
     assert((causal_broadcast != NULL) == true);
     while(true){
         Packet p = packets_to_deliver.pop();
+        delivered_packets.add();
+        TRACE_EVENT(URB_DELIVER, p.source_id, p.packet_seq_num);
         //DEBUG_MSG("URBDeliver: packet source: " <<  p.source_id << " sender: " << p.process_id << " seq_num: "  << p.packet_seq_num);
         causal_broadcast -> URBDeliver(p);
     }
@@ -17,53 +48,519 @@ void UniformReliableBroadcast::URBDeliver(){
 
 
 void UniformReliableBroadcast::BEBDeliver(Packet p){
-    acks[p.source_id][p.packet_seq_num].insert(p.process_id);
-
     DEBUG_MSG("BEBDeliver: packet source: " <<  p.source_id << " sender: " << p.process_id << " seq_num: "  << p.packet_seq_num);
 
-    pending_mutex.lock();
+    std::vector<Packet> ready;
+    if (p.source_id == CONTROL_SOURCE){
+        receiveDigest(p, ready);
+    }
+    else if (relay_mode == FULL){
+        receiveRelay(p, ready);
+    }
+    else{
+        receivePayload(p, ready);
+    }
+    if (!beb -> hasPacketsToDeliver()){
+        flushDigest();
+    }
+    // no lock is held here, because you could wait on the next instruction
+    for (Packet & ready_packet : ready){
+        packets_to_deliver.push(ready_packet);
+    }
+}
+
 
-    if ((pending[p.source_id].count(p.packet_seq_num) == 0) // packet not in pending 
-             && (delivered[p.source_id].count(p.packet_seq_num) == 0)){ // packet not delivered
+void UniformReliableBroadcast::receiveRelay(Packet & p, std::vector<Packet> & ready){
+    URBShard & shard = getShard(p.source_id);
+    std::unique_lock<std::mutex> lock(shard.mutex);
 
-        pending[p.source_id].insert(p.packet_seq_num);
-        pending_mutex.unlock(); // free lock because you could wait on the next instruction
+    if (shard.delivered[p.source_id].contains(p.packet_seq_num)){
+        // late relay: the packet was already delivered (and re-broadcast), its acks are not needed anymore
+        late_relays.add();
+        return;
+    }
+    shard.acks[p.source_id][p.packet_seq_num].insert(p.process_id);
+
+    if (shard.pending[p.source_id].count(p.packet_seq_num) == 0){ // packet not in pending (nor delivered)
+        shard.pending[p.source_id].insert(p.packet_seq_num);
 
         DEBUG_MSG("BEBDeliver: about to RE-Broadcast, source " <<  p.source_id << " previous sender: " << p.process_id << " seq_num: "  << p.packet_seq_num);
-        // change sender process to this one 
-        p.changeSenderId(process_id);
-        beb -> re_broadcast(p);
-        DEBUG_MSG("successfully added to packets_to_re_broadcast");
-        pending_mutex.lock(); //regain lock for next part of execution
+        // change sender process to this one, re-broadcasts never block so the lock can be kept
+        Packet relay = p;
+        relay.changeSenderId(process_id);
+        beb -> re_broadcast(relay);
+        relayed.add();
     }
 
-    // see if packet can be URBDelivered 
-    if (canDeliver(p.source_id, p.packet_seq_num) && // majority BEBdelivered packet
-        (pending[p.source_id].count(p.packet_seq_num) == 1) && // packet is in pending
-        (delivered[p.source_id].count(p.packet_seq_num) == 0)){ // packet is not delivered 
+    // see if packet can be URBDelivered (it is pending and not delivered)
+    if (canDeliver(shard, p.source_id, p.packet_seq_num)){ // majority BEBdelivered packet
+        shard.delivered[p.source_id].insert(p.packet_seq_num);
+        shard.pending[p.source_id].erase(p.packet_seq_num);
+        shard.acks[p.source_id].erase(p.packet_seq_num);
+        ready.push_back(p);
+    }
+}
 
-        delivered[p.source_id].insert(p.packet_seq_num);
-        pending[p.source_id].erase(p.packet_seq_num);
-        
-        pending_mutex.unlock(); // free lock because you could wait on the next instruction
-        packets_to_deliver.push(p);
+
+void UniformReliableBroadcast::receivePayload(Packet & p, std::vector<Packet> & ready){
+    std::size_t source_id = p.source_id;
+    std::size_t seq_num = p.packet_seq_num;
+    URBShard & shard = getShard(source_id);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (shard.delivered[source_id].contains(seq_num) && shard.acks[source_id].count(seq_num) == 0){
+        // already delivered and reclaimed
+        late_relays.add();
+        return;
     }
-    else{
-        pending_mutex.unlock();
+    // the payload sent by the origin or by a holder counts as its ack
+    shard.acks[source_id][seq_num].insert(p.process_id);
+    if (shard.held[source_id].count(seq_num) == 0){
+        shard.held[source_id][seq_num] = p;
+        shard.acks[source_id][seq_num].insert(process_id);
+        shard.missing[source_id].erase(seq_num);
+        std::string have = std::to_string(HAVE) + " " + std::to_string(source_id) + " " + std::to_string(seq_num);
+        if (relay_mode == DIGEST){
+            if (source_id != process_id){
+                // the origin acks its own packets by sending them
+                addRecordToAll(have);
+            }
+        }
+        else{
+            TreeState & state = shard.tree[source_id][seq_num];
+            state.held_since = std::chrono::steady_clock::now();
+            std::vector<std::size_t> children = treeChildren(process_id, source_id);
+            if (source_id != process_id && !children.empty()){
+                // the origin sent the packet to its children itself, re-broadcasts never block
+                Packet relay = p;
+                relay.changeSenderId(process_id);
+                beb -> re_broadcast(relay, children);
+                relayed.add();
+            }
+            if (state.flat){
+                addRecordToAll(have);
+            }
+            treeProgress(shard, source_id, seq_num, false);
+        }
+    }
+    deliverIfReady(shard, source_id, seq_num, ready);
+}
+
+
+void UniformReliableBroadcast::receiveDigest(Packet & p, std::vector<Packet> & ready){
+    auto now = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < p.getNumMessages(); i++){
+        std::istringstream record(p.getMessage(i).getContent());
+        std::size_t type, source_id, seq_num;
+        record >> type;
+        if (type == STABILITY){
+            receiveDeliveredPrefixes(p.process_id, record);
+            continue;
+        }
+        if (type == PULL){
+            std::size_t holder_id;
+            record >> holder_id >> source_id >> seq_num;
+            if (holder_id != process_id){
+                continue;
+            }
+            URBShard & shard = getShard(source_id);
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            if (shard.held[source_id].count(seq_num) == 1){
+                Packet payload = shard.held[source_id][seq_num];
+                payload.changeSenderId(process_id);
+                DEBUG_MSG("URB answering pull from " << p.process_id << ": source: " << source_id << " seq_num: " << seq_num);
+                beb -> send(payload, p.process_id);
+                pulls_answered.add();
+            }
+            continue;
+        }
+
+        record >> source_id >> seq_num;
+        URBShard & shard = getShard(source_id);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        if (shard.delivered[source_id].contains(seq_num) && shard.acks[source_id].count(seq_num) == 0){
+            if (type == HAVE && relay_mode == TREE){
+                // the sender fell back to digest mode for a packet this process already reclaimed
+                addRecord(p.process_id, std::to_string(DELIVERED) + " " + std::to_string(source_id) + " " + std::to_string(seq_num));
+            }
+            continue;
+        }
+        if (type == HAVE){
+            receiveHave(shard, p.process_id, source_id, seq_num, ready, now);
+        }
+        else if (type == SUBTREE){
+            std::size_t count;
+            record >> count;
+            std::size_t & child_count = shard.tree[source_id][seq_num].child_counts[p.process_id];
+            child_count = std::max(child_count, count);
+            treeProgress(shard, source_id, seq_num, false);
+            deliverIfReady(shard, source_id, seq_num, ready);
+        }
+        else{
+            receiveTreeRecord(shard, type, p.process_id, source_id, seq_num, ready);
+        }
+    }
+}
+
+
+void UniformReliableBroadcast::receiveHave(URBShard & shard, std::size_t sender_id, std::size_t source_id,
+                                           std::size_t seq_num, std::vector<Packet> & ready,
+                                           std::chrono::steady_clock::time_point now){
+    shard.acks[source_id][seq_num].insert(sender_id);
+    if (relay_mode == TREE){
+        // the sender fell back to digest mode for the packet, so does this process
+        fallBack(shard, source_id, seq_num);
+    }
+    if (shard.held[source_id].count(seq_num) == 1){
+        deliverIfReady(shard, source_id, seq_num, ready);
+        return;
+    }
+    auto it_missing = shard.missing[source_id].find(seq_num);
+    if (it_missing == shard.missing[source_id].end()){
+        it_missing = shard.missing[source_id].insert(std::make_pair(seq_num, MissingPayload())).first;
+        it_missing -> second.first_seen = now;
+    }
+    it_missing -> second.holders.push_back(sender_id);
+    if (it_missing -> second.num_pulls == 0 && beb -> isSuspected(source_id)){
+        pull(source_id, seq_num, it_missing -> second, now);
+    }
+}
+
+
+void UniformReliableBroadcast::receiveTreeRecord(URBShard & shard, std::size_t type, std::size_t sender_id,
+                                                 std::size_t source_id, std::size_t seq_num, std::vector<Packet> & ready){
+    TreeState & state = shard.tree[source_id][seq_num];
+    if (type == DELIVERED){
+        // the sender held the packet, and delivered it because a majority did
+        shard.acks[source_id][seq_num].insert(sender_id);
+    }
+    std::vector<std::size_t> children = treeChildren(process_id, source_id);
+    std::string suffix = " " + std::to_string(source_id) + " " + std::to_string(seq_num);
+    if (type == COMPLETE && !state.complete){
+        state.complete = true;
+        state.stable = true;
+        addRecord(children, std::to_string(COMPLETE) + suffix);
+    }
+    else if (!state.stable){
+        state.stable = true;
+        addRecord(children, std::to_string(STABLE) + suffix);
+    }
+    deliverIfReady(shard, source_id, seq_num, ready);
+}
+
+
+void UniformReliableBroadcast::deliverIfReady(URBShard & shard, std::size_t source_id, std::size_t seq_num,
+                                              std::vector<Packet> & ready){
+    auto it_held = shard.held[source_id].find(seq_num);
+    if (it_held == shard.held[source_id].end()){
+        return;
+    }
+    if (!shard.delivered[source_id].contains(seq_num)){
+        bool stable = relay_mode == TREE && shard.tree[source_id][seq_num].stable;
+        if (stable || canDeliver(shard, source_id, seq_num)){
+            shard.delivered[source_id].insert(seq_num);
+            shard.pending[source_id].erase(seq_num);
+            ready.push_back(it_held -> second);
+        }
+    }
+    reclaimIfComplete(shard, source_id, seq_num);
+}
+
+
+void UniformReliableBroadcast::reclaimIfComplete(URBShard & shard, std::size_t source_id, std::size_t seq_num){
+    if (!shard.delivered[source_id].contains(seq_num)){
+        return;
+    }
+    bool complete = false;
+    if (relay_mode == TREE){
+        auto it_state = shard.tree[source_id].find(seq_num);
+        complete = it_state != shard.tree[source_id].end() && it_state -> second.complete;
+    }
+    ProcessSet & holders = shard.acks[source_id][seq_num];
+    if (!complete && holders.size() < num_processes){
+        return;
+    }
+    shard.acks[source_id].erase(seq_num);
+    shard.held[source_id].erase(seq_num);
+    shard.tree[source_id].erase(seq_num);
+}
+
+
+void UniformReliableBroadcast::pull(std::size_t source_id, std::size_t seq_num, MissingPayload & missing_payload,
+                                    std::chrono::steady_clock::time_point now){
+    std::size_t holder_id = missing_payload.holders[missing_payload.num_pulls % missing_payload.holders.size()];
+    DEBUG_MSG("URB pulling from " << holder_id << ": source: " << source_id << " seq_num: " << seq_num);
+    // sent to every process, only holder_id answers
+    addRecordToAll(std::to_string(PULL) + " " + std::to_string(holder_id) + " " + std::to_string(source_id) + " " + std::to_string(seq_num));
+    missing_payload.num_pulls++;
+    missing_payload.last_pull = now;
+    pulls_sent.add();
+}
+
+
+std::vector<std::size_t> UniformReliableBroadcast::treeChildren(std::size_t id, std::size_t source_id){
+    std::vector<std::size_t> children;
+    std::size_t rank = treeRank(id, source_id);
+    for (std::size_t child_rank = rank * tree_fanout + 1;
+         child_rank <= rank * tree_fanout + tree_fanout && child_rank < num_processes; child_rank++){
+        children.push_back(treeId(child_rank, source_id));
+    }
+    return children;
+}
+
+
+void UniformReliableBroadcast::treeProgress(URBShard & shard, std::size_t source_id, std::size_t seq_num, bool force_report){
+    TreeState & state = shard.tree[source_id][seq_num];
+    std::size_t count = shard.held[source_id].count(seq_num);
+    for (auto & child_count : state.child_counts){
+        count += child_count.second;
+    }
+    std::size_t rank = treeRank(process_id, source_id);
+    std::string suffix = " " + std::to_string(source_id) + " " + std::to_string(seq_num);
+    if (rank != 0){
+        if (count > state.reported && (count == subtree_sizes[rank] || force_report)){
+            addRecord(treeParent(process_id, source_id), std::to_string(SUBTREE) + suffix + " " + std::to_string(count));
+            state.reported = count;
+        }
+        return;
+    }
+    if (!state.complete && count == num_processes){
+        DEBUG_MSG("URB tree complete: source: " << source_id << " seq_num: " << seq_num);
+        state.complete = true;
+        state.stable = true;
+        addRecord(treeChildren(process_id, source_id), std::to_string(COMPLETE) + suffix);
+    }
+    else if (!state.stable && count > num_processes / 2){
+        state.stable = true;
+        addRecord(treeChildren(process_id, source_id), std::to_string(STABLE) + suffix);
+    }
+}
+
+
+void UniformReliableBroadcast::fallBack(URBShard & shard, std::size_t source_id, std::size_t seq_num){
+    TreeState & state = shard.tree[source_id][seq_num];
+    if (state.flat){
+        return;
+    }
+    DEBUG_MSG("URB tree fall back: source: " << source_id << " seq_num: " << seq_num);
+    state.flat = true;
+    if (shard.held[source_id].count(seq_num) == 1){
+        addRecordToAll(std::to_string(HAVE) + " " + std::to_string(source_id) + " " + std::to_string(seq_num));
+    }
+}
+
+
+void UniformReliableBroadcast::addRecord(std::size_t dest_id, std::string record){
+    addRecord(std::vector<std::size_t>(1, dest_id), record);
+}
+
+
+void UniformReliableBroadcast::addRecord(std::vector<std::size_t> dest_ids, std::string record){
+    std::unique_lock<std::mutex> lock(digest_mutex);
+    Message message(record);
+    for (std::size_t dest_id : dest_ids){
+        auto it_control = control_packets.find(dest_id);
+        if (it_control == control_packets.end()){
+            it_control = control_packets.insert(std::make_pair(dest_id,
+                            Packet(process_id, CONTROL_SOURCE, control_seq_nums[dest_id], 0, VectorClock(0)))).first;
+        }
+        if (!it_control -> second.canAddMessage(message)){
+            // re-broadcasts never block, the lock can be kept
+            beb -> send(it_control -> second, dest_id);
+            control_seq_nums[dest_id]++;
+            it_control -> second = Packet(process_id, CONTROL_SOURCE, control_seq_nums[dest_id], 0, VectorClock(0));
+        }
+        it_control -> second.addMessage(message);
+    }
+}
+
+
+void UniformReliableBroadcast::addRecordToAll(std::string record){
+    std::vector<std::size_t> dest_ids;
+    for (std::size_t id = 1; id <= num_processes; id++){
+        if (id != process_id){
+            dest_ids.push_back(id);
+        }
+    }
+    addRecord(dest_ids, record);
+}
+
+
+void UniformReliableBroadcast::flushDigest(){
+    std::unique_lock<std::mutex> lock(digest_mutex);
+    for (auto it_control = control_packets.begin(); it_control != control_packets.end(); ++it_control){
+        if (it_control -> second.getNumMessages() == 0){
+            continue;
+        }
+        std::size_t dest_id = it_control -> first;
+        beb -> send(it_control -> second, dest_id);
+        control_seq_nums[dest_id]++;
+        it_control -> second = Packet(process_id, CONTROL_SOURCE, control_seq_nums[dest_id], 0, VectorClock(0));
+    }
+}
+
+
+void UniformReliableBroadcast::announceDeliveredPrefixes(){
+    std::vector<std::size_t> prefixes(num_processes, 0);
+    for (std::size_t source_id = 1; source_id <= num_processes; source_id++){
+        URBShard & shard = getShard(source_id);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        prefixes[source_id - 1] = shard.delivered[source_id].getNextMissing();
+    }
+    std::string record = std::to_string(STABILITY);
+    for (std::size_t prefix : prefixes){
+        record += " " + std::to_string(prefix);
+    }
+    {
+        std::unique_lock<std::mutex> lock(stability_mutex);
+        delivered_prefixes[process_id] = prefixes;
+    }
+    addRecordToAll(record);
+}
+
+
+void UniformReliableBroadcast::receiveDeliveredPrefixes(std::size_t sender_id, std::istringstream & record){
+    std::vector<std::size_t> prefixes(num_processes, 0);
+    for (std::size_t i = 0; i < num_processes; i++){
+        record >> prefixes[i];
+    }
+    std::unique_lock<std::mutex> lock(stability_mutex);
+    std::vector<std::size_t> & known = delivered_prefixes[sender_id];
+    if (known.empty()){
+        known = prefixes;
+        return;
+    }
+    // records of different control packets may be reordered
+    for (std::size_t i = 0; i < num_processes; i++){
+        known[i] = std::max(known[i], prefixes[i]);
+    }
+}
+
+
+void UniformReliableBroadcast::trimStable(){
+    std::vector<std::size_t> new_watermark(num_processes, 0);
+    {
+        std::unique_lock<std::mutex> lock(stability_mutex);
+        bool first = true;
+        for (std::size_t id = 1; id <= num_processes; id++){
+            auto it_prefixes = delivered_prefixes.find(id);
+            if (it_prefixes == delivered_prefixes.end()){
+                // nothing is known about id yet
+                return;
+            }
+            for (std::size_t i = 0; i < num_processes; i++){
+                new_watermark[i] = first ? it_prefixes -> second[i] : std::min(new_watermark[i], it_prefixes -> second[i]);
+            }
+            first = false;
+        }
+        if (new_watermark == watermark){
+            return;
+        }
+        watermark = new_watermark;
+    }
+
+    // every packet below the watermark is delivered by this process too
+    for (std::size_t source_id = 1; source_id <= num_processes; source_id++){
+        std::size_t stable_below = new_watermark[source_id - 1];
+        URBShard & shard = getShard(source_id);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        std::map<std::size_t, ProcessSet> & source_acks = shard.acks[source_id];
+        source_acks.erase(source_acks.begin(), source_acks.lower_bound(stable_below));
+        std::map<std::size_t, Packet> & source_held = shard.held[source_id];
+        source_held.erase(source_held.begin(), source_held.lower_bound(stable_below));
+        std::map<std::size_t, MissingPayload> & source_missing = shard.missing[source_id];
+        source_missing.erase(source_missing.begin(), source_missing.lower_bound(stable_below));
+        std::map<std::size_t, TreeState> & source_tree = shard.tree[source_id];
+        source_tree.erase(source_tree.begin(), source_tree.lower_bound(stable_below));
+    }
+    beb -> trimDelivered(new_watermark);
+}
+
+
+void UniformReliableBroadcast::repair(){
+    auto next_reclaim = std::chrono::steady_clock::now() + reclaim_period;
+    auto next_stability = std::chrono::steady_clock::now() + stability_period;
+    while(true){
+        std::this_thread::sleep_for(repair_period);
+        auto now = std::chrono::steady_clock::now();
+        bool reclaim = now >= next_reclaim;
+        if (reclaim){
+            next_reclaim = now + reclaim_period;
+        }
+        if (stability_period.count() > 0 && now >= next_stability){
+            next_stability = now + stability_period;
+            announceDeliveredPrefixes();
+            trimStable();
+        }
+
+        for (URBShard & shard : shards){
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            for (auto it_source = shard.missing.begin(); it_source != shard.missing.end(); ++it_source){
+                bool origin_suspected = beb -> isSuspected(it_source -> first);
+                for (auto it_seq = it_source -> second.begin(); it_seq != it_source -> second.end(); ++it_seq){
+                    MissingPayload & missing_payload = it_seq -> second;
+                    bool due = missing_payload.num_pulls == 0 ?
+                                    (origin_suspected || now - missing_payload.first_seen >= pull_timeout) :
+                                    now - missing_payload.last_pull >= pull_timeout;
+                    if (due){
+                        pull(it_source -> first, it_seq -> first, missing_payload, now);
+                    }
+                }
+            }
+
+            for (auto it_source = shard.tree.begin(); it_source != shard.tree.end(); ++it_source){
+                for (auto it_seq = it_source -> second.begin(); it_seq != it_source -> second.end(); ++it_seq){
+                    TreeState & state = it_seq -> second;
+                    if (state.complete || shard.held[it_source -> first].count(it_seq -> first) == 0){
+                        continue;
+                    }
+                    // partial report of a subtree with slow or crashed processes
+                    if (now - state.held_since >= tree_report_timeout){
+                        treeProgress(shard, it_source -> first, it_seq -> first, true);
+                    }
+                    if (now - state.held_since >= tree_fallback_timeout){
+                        fallBack(shard, it_source -> first, it_seq -> first);
+                    }
+                }
+            }
+
+            if (reclaim){
+                for (auto it_source = shard.held.begin(); it_source != shard.held.end(); ++it_source){
+                    std::vector<std::size_t> seq_nums;
+                    for (auto it_seq = it_source -> second.begin(); it_seq != it_source -> second.end(); ++it_seq){
+                        seq_nums.push_back(it_seq -> first);
+                    }
+                    for (std::size_t seq_num : seq_nums){
+                        reclaimIfComplete(shard, it_source -> first, seq_num);
+                    }
+                }
+            }
+        }
+        flushDigest();
     }
 }
 
 
 void UniformReliableBroadcast::broadcast(Packet p){
-    pending_mutex.lock();
-    pending[p.source_id].insert(p.packet_seq_num);
-    pending_mutex.unlock();
+    URBShard & shard = getShard(p.source_id);
+    shard.mutex.lock();
+    shard.pending[p.source_id].insert(p.packet_seq_num);
+    shard.mutex.unlock();
 
     DEBUG_MSG("URB Broadcasting: packet seq_num: "  << p.packet_seq_num);
-    beb -> broadcast(p);
+    if (relay_mode == TREE){
+        // the root of the tree sends the packet to its children, and to itself to hold it
+        std::vector<std::size_t> dest_ids = treeChildren(process_id, process_id);
+        dest_ids.push_back(process_id);
+        beb -> broadcast(p, dest_ids);
+    }
+    else{
+        beb -> broadcast(p);
+    }
 }
 
 void UniformReliableBroadcast::start(){
-    std::thread * deliver_thread = new std::thread([this] {this -> URBDeliver();});
+    std::thread * deliver_thread = new std::thread([this] {TRACE_THREAD("urb_deliver"); this -> URBDeliver();});
     threads.push_back(deliver_thread);
-}
\ No newline at end of file
+    std::thread * repair_thread = new std::thread([this] {TRACE_THREAD("urb_repair"); this -> repair();});
+    threads.push_back(repair_thread);
+}
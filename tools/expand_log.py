@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+
+# Converts an output file written with DA_LOG_RANGES=1 ("b first last", "d source first last")
+# to the canonical format, one line per message ("b seq", "d source seq"). Lines already in the
+# canonical format are copied, so the conversion can be applied to any output file.
+# The file is streamed, the output is written to OUTPUT (standard output if not given)
+
+import argparse
+import sys
+
+# lines per write
+BATCH = 65536
+
+
+def expand(inputFile, outputFile):
+    pending = []
+
+    def flush():
+        outputFile.write("".join(pending))
+        pending.clear()
+
+    def extendRange(prefix, first, last):
+        # a range can hold any number of messages: it is written in chunks of at most BATCH lines
+        for start in range(first, last + 1, BATCH):
+            pending.extend(prefix + str(seq) + "\n" for seq in range(start, min(start + BATCH, last + 1)))
+            if len(pending) >= BATCH:
+                flush()
+
+    for line in inputFile:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == 'b' and len(fields) == 3:
+            extendRange("b ", int(fields[1]), int(fields[2]))
+        elif fields[0] == 'd' and len(fields) == 4:
+            extendRange("d {} ".format(fields[1]), int(fields[2]), int(fields[3]))
+        else:
+            pending.append(line if line.endswith("\n") else line + "\n")
+            if len(pending) >= BATCH:
+                flush()
+    flush()
+
+
+def main(inputPath, outputPath):
+    with open(inputPath) as inputFile:
+        if outputPath is None:
+            expand(inputFile, sys.stdout)
+        else:
+            with open(outputPath, 'w') as outputFile:
+                expand(inputFile, outputFile)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        "input",
+        help="Output file of a process, written with DA_LOG_RANGES=1",
+    )
+
+    parser.add_argument(
+        "output",
+        nargs="?",
+        default=None,
+        help="Converted file (default: standard output)",
+    )
+
+    results = parser.parse_args()
+
+    main(results.input, results.output)
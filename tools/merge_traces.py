@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+
+# Merges the Chrome trace files written by the processes of a host (built with -DDA_TRACE=ON) in a single
+# file, to be opened with chrome://tracing or ui.perfetto.dev. The timestamps of the processes are on the
+# same clock, so a packet can be followed from its broadcast to its delivery on every process
+# (each process is a pid, the events of a packet have the same source and seq arguments)
+
+import argparse
+import json
+
+
+def main(inputPaths, outputPath):
+    events = []
+    for path in inputPaths:
+        with open(path) as inputFile:
+            events.extend(json.load(inputFile)["traceEvents"])
+    with open(outputPath, 'w') as outputFile:
+        json.dump({"traceEvents": events}, outputFile)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        "--output",
+        required=True,
+        dest="output",
+        help="Merged trace file",
+    )
+
+    parser.add_argument(
+        "inputs",
+        nargs="+",
+        help="Trace files of the processes (output file + .trace.json)",
+    )
+
+    results = parser.parse_args()
+
+    main(results.inputs, results.output)
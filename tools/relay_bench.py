@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+
+# Compares the URB relay modes (DA_URB_RELAY=full|digest|tree) for growing numbers of processes:
+# runs all the processes for a fixed time in each mode and reports, per process, the messages
+# delivered per second, the CPU time and the bytes sent per delivered message.
+# Bytes are read from the pl_bytes_sent counters of the metrics file of each process (DA_METRICS_FILE),
+# so a Release build can be measured
+
+import argparse
+import os
+import re
+import signal
+import subprocess
+import time
+
+PROCESSES_BASE_IP = 11000
+
+# period of the metrics snapshots, the last one is at most this old when the process stops
+METRICS_PERIOD_MS = 100
+
+BYTES_SENT = re.compile(r'^pl_bytes_sent\{peer="(\d+)"\} (\d+)$')
+
+
+def generateLcausalConfig(directory, processes, messages):
+    hostsfile = os.path.join(directory, 'hosts')
+    configfile = os.path.join(directory, 'config')
+
+    with open(hostsfile, 'w') as hosts:
+        for i in range(1, processes + 1):
+            hosts.write("{} localhost {}\n".format(i, PROCESSES_BASE_IP+i))
+
+    # every process depends on the previous one, so that causal delivery is exercised
+    with open(configfile, 'w') as config:
+        config.write("{}\n".format(messages))
+        for i in range(1, processes + 1):
+            if i > 1:
+                config.write("{} {}\n".format(i, i - 1))
+            else:
+                config.write("{}\n".format(i))
+
+    return (hostsfile, configfile)
+
+
+def findBinary(runscript):
+    runscriptPath = os.path.abspath(runscript)
+    if os.path.basename(runscriptPath) != 'run.sh':
+        raise Exception("`{}` is not a runscript".format(runscriptPath))
+
+    baseDir, _ = os.path.split(runscriptPath)
+    bin_cpp = os.path.join(baseDir, "bin", "da_proc")
+    if not os.path.exists(bin_cpp):
+        raise Exception("`{}` could not find a binary to execute. Make sure you build before running".format(runscriptPath))
+    return bin_cpp
+
+
+def bytesSent(metricsPath):
+    # the counters are cumulative, keep the last snapshot of every destination
+    last = {}
+    if not os.path.exists(metricsPath):
+        return 0
+    with open(metricsPath, errors='replace') as metrics:
+        for line in metrics:
+            match = BYTES_SENT.match(line.rstrip('\n'))
+            if match:
+                last[match.group(1)] = int(match.group(2))
+    return sum(last.values())
+
+
+def deliveries(outputPath):
+    if not os.path.exists(outputPath):
+        return 0
+    with open(outputPath) as output:
+        return sum(1 for line in output if line.startswith('d'))
+
+
+def runMode(binary, mode, processes, messages, duration, logsDir):
+    runDir = os.path.join(logsDir, "{}-{}".format(mode, processes))
+    os.makedirs(runDir, exist_ok=True)
+    hostsFile, configFile = generateLcausalConfig(runDir, processes, messages)
+
+    env = dict(os.environ)
+    env['DA_URB_RELAY'] = mode
+    # the metrics file is appended to, the snapshots of a previous run are dropped
+    for pid in range(1, processes + 1):
+        metricsPath = os.path.join(runDir, f'{pid}.metrics')
+        if os.path.exists(metricsPath):
+            os.remove(metricsPath)
+    env['DA_METRICS_FILE'] = os.path.join(runDir, '{id}.metrics')
+    env['DA_METRICS_PERIOD_MS'] = str(METRICS_PERIOD_MS)
+
+    procs = []
+    for pid in range(1, processes + 1):
+        cmd = [binary, '--id', str(pid),
+               '--hosts', hostsFile,
+               '--output', os.path.join(runDir, f'{pid}.output'),
+               configFile]
+        stdoutFd = open(os.path.join(runDir, f'{pid}.stdout'), "w")
+        stderrFd = open(os.path.join(runDir, f'{pid}.stderr'), "w")
+        procs.append((pid, subprocess.Popen(cmd, stdout=stdoutFd, stderr=stderrFd, env=env)))
+
+    time.sleep(duration)
+    for _, proc in procs:
+        proc.send_signal(signal.SIGTERM)
+
+    cpu = 0.0
+    for _, proc in procs:
+        _, _, rusage = os.wait4(proc.pid, 0)
+        cpu += rusage.ru_utime + rusage.ru_stime
+
+    delivered = sum(deliveries(os.path.join(runDir, f'{pid}.output')) for pid, _ in procs)
+    sent = sum(bytesSent(os.path.join(runDir, f'{pid}.metrics')) for pid, _ in procs)
+
+    return {
+        'delivered_per_sec': delivered / processes / duration,
+        'cpu_per_sec': cpu / processes / duration,
+        'bytes_per_delivery': sent / delivered if delivered > 0 else float('inf'),
+        'cpu_us_per_delivery': cpu * 1e6 / delivered if delivered > 0 else float('inf'),
+    }
+
+
+def main(runscript, processesList, modes, messages, duration, logsDir):
+    if not os.path.isdir(logsDir):
+        raise ValueError('Directory `{}` does not exist'.format(logsDir))
+    binary = findBinary(runscript)
+
+    results = {}
+    print("{:>5} {:>7} {:>14} {:>10} {:>12} {:>12}".format(
+        "N", "mode", "deliv/s/proc", "cpu/proc", "bytes/deliv", "us cpu/deliv"))
+    for processes in processesList:
+        for mode in modes:
+            result = runMode(binary, mode, processes, messages, duration, logsDir)
+            results[(processes, mode)] = result
+            print("{:>5} {:>7} {:>14.0f} {:>10.2f} {:>12.1f} {:>12.2f}".format(
+                processes, mode, result['delivered_per_sec'], result['cpu_per_sec'],
+                result['bytes_per_delivery'], result['cpu_us_per_delivery']), flush=True)
+
+    # crossover: smallest number of processes from which tree mode costs less than every other mode
+    for metric in ['bytes_per_delivery', 'cpu_us_per_delivery']:
+        crossover = None
+        for processes in processesList:
+            others = [results[(processes, mode)][metric] for mode in modes if mode != 'tree']
+            if 'tree' in modes and others and results[(processes, 'tree')][metric] < min(others):
+                if crossover is None:
+                    crossover = processes
+            else:
+                crossover = None
+        if crossover is None:
+            print("{}: tree mode is not the cheapest at the largest N".format(metric))
+        else:
+            print("{}: tree mode is the cheapest from N = {}".format(metric, crossover))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        "-r",
+        "--runscript",
+        required=True,
+        dest="runscript",
+        help="Path to run.sh",
+    )
+
+    parser.add_argument(
+        "-l",
+        "--logs",
+        required=True,
+        dest="logsDir",
+        help="Directory to store stdout, stderr and outputs generated by the processes",
+    )
+
+    parser.add_argument(
+        "-p",
+        "--processes",
+        default="4,8,16,32",
+        dest="processes",
+        help="Comma separated numbers of processes to try",
+    )
+
+    parser.add_argument(
+        "--modes",
+        default="full,digest,tree",
+        dest="modes",
+        help="Comma separated relay modes to compare",
+    )
+
+    parser.add_argument(
+        "-m",
+        "--messages",
+        default=10000000,
+        type=int,
+        dest="messages",
+        help="Number of messages that each process broadcasts (the run is stopped after the duration)",
+    )
+
+    parser.add_argument(
+        "-d",
+        "--duration",
+        default=10,
+        type=float,
+        dest="duration",
+        help="Seconds each configuration runs",
+    )
+
+    results = parser.parse_args()
+
+    main(results.runscript, [int(n) for n in results.processes.split(',')],
+         results.modes.split(','), results.messages, results.duration, results.logsDir)
@@ -216,7 +216,7 @@ class StressTest:
         else:
             self.stress()
 
-def startProcesses(processes, runscript, hostsFilePath, configFilePath, outputDir):
+def startProcesses(processes, runscript, hostsFilePath, configFilePath, outputDir, linkMode=None):
     runscriptPath = os.path.abspath(runscript)
     if not os.path.isfile(runscriptPath):
         raise Exception("`{}` is not a file".format(runscriptPath))
@@ -239,6 +239,11 @@ def startProcesses(processes, runscript, hostsFilePath, configFilePath, outputDi
     else:
         raise Exception("`{}` could not find a binary to execute. Make sure you build before validating".format(runscriptPath))
 
+    # the perfect link mode (DA_LINK_MODE) of every process, inherited from the environment if not given
+    env = dict(os.environ)
+    if linkMode is not None:
+        env['DA_LINK_MODE'] = linkMode
+
     procs = []
     for pid in range(1, processes+1):
         cmd_ext = ['--id', str(pid),
@@ -250,11 +255,11 @@ def startProcesses(processes, runscript, hostsFilePath, configFilePath, outputDi
         stderrFd = open(os.path.join(outputDirPath, f'{pid}.stderr'), "w")
 
 
-        procs.append((pid, subprocess.Popen(cmd + cmd_ext, stdout=stdoutFd, stderr=stderrFd)))
+        procs.append((pid, subprocess.Popen(cmd + cmd_ext, stdout=stdoutFd, stderr=stderrFd, env=env)))
 
     return procs
 
-def main(processes, messages, runscript, testType, logsDir, testConfig):
+def main(processes, messages, runscript, testType, logsDir, testConfig, linkMode=None):
     if not os.path.isdir(logsDir):
         raise ValueError('Directory `{}` does not exist'.format(logsDir))
 
@@ -271,7 +276,7 @@ def main(processes, messages, runscript, testType, logsDir, testConfig):
 
     try:
         # Start the processes and get their PIDs
-        procs = startProcesses(processes, runscript, hostsFile, configFile, logsDir)
+        procs = startProcesses(processes, runscript, hostsFile, configFile, logsDir, linkMode)
 
         # Create the stress test
         st = StressTest(procs,
@@ -358,6 +363,14 @@ if __name__ == "__main__":
         help="Maximum number (because it can crash) of messages that each process can broadcast",
     )
 
+    parser.add_argument(
+        "--link-mode",
+        choices=["ack", "nack"],
+        default=None,
+        dest="linkMode",
+        help="Perfect link mode of the processes (DA_LINK_MODE), default: the one of the environment",
+    )
+
     results = parser.parse_args()
 
     testConfig = {
@@ -370,4 +383,4 @@ if __name__ == "__main__":
         }
     }
 
-    main(results.processes, results.messages, results.runscript, results.testType, results.logsDir, testConfig)
+    main(results.processes, results.messages, results.runscript, results.testType, results.logsDir, testConfig, results.linkMode)
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Same as stress.sh, with the perfect links in nack mode (cumulative acks and nacks)
+# Change the current working directory to the location of the present file
+cd "$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null 2>&1 && pwd )"
+rm ../example/output/*
+python3 ./stress.py -r ../template_cpp/run.sh -t lcausal -l ../example/output -p 10 -m 100000 --link-mode nack